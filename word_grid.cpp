@@ -20,41 +20,471 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <fstream>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <list>
+#include <memory>
 #include <mutex>
+#include <new>
+#include <numeric>
 #include <optional>
+#include <random>
+#include <sstream>
 #include <string>
+#include <string_view>
 #include <thread>
-#include <tuple>
-#include <unordered_set>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 
+#include <fcntl.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
 #include <getopt.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "word_grid_offload.hpp"
+
+// the most letters an alphabet can have. Letters are stored as 'A' + their index, so there can be up to 62,
+// from 'A' to '~'. Set at build time, as it sizes the trie nodes, and letter masks widen to 64 bits past 32
+const int ALPHABET_LEN = WORD_GRID_MAX_LETTERS;
+static_assert(ALPHABET_LEN >= 26 && ALPHABET_LEN <= '~' - 'A' + 1, "WORD_GRID_MAX_LETTERS must be from 26, for A to Z, to 62");
+
+// bit i set if letter 'A' + i is in a word
+using Letter_mask = std::conditional_t<ALPHABET_LEN <= 32, std::uint32_t, std::uint64_t>;
+
+// index of the lowest letter in a non-empty mask
+inline int lowest_letter(const Letter_mask mask)
+{
+    return __builtin_ctzll(mask);
+}
+
+Letter_mask get_letter_mask(const char * word, const std::size_t length)
+{
+    Letter_mask mask = 0;
+    for(std::size_t i = 0; i < length; ++i)
+        mask |= Letter_mask{1} << (word[i] - 'A');
+    return mask;
+}
+
+// FNV-1a
+std::uint64_t hash_bytes(const void * data, const std::size_t size, std::uint64_t h = 0xcbf29ce484222325)
+{
+    for(std::size_t i = 0; i < size; ++i)
+    {
+        h ^= static_cast<const unsigned char *>(data)[i];
+        h *= 0x100000001b3;
+    }
+    return h;
+}
+
+// read-only view of an array, either owned by a Dictionary or mapped in from an index file
+template <typename T>
+struct Array_view
+{
+    const T * data = nullptr;
+    std::size_t size = 0;
+
+    Array_view() = default;
+    Array_view(const T * data, const std::size_t size): data{data}, size{size} {}
+    explicit Array_view(const std::vector<T> & vec): data{vec.data()}, size{vec.size()} {}
+
+    const T & operator[](const std::size_t i) const { return data[i]; }
+    const T * begin() const { return data; }
+    const T * end() const { return data + size; }
+};
+
+// prefix tree of column words, stored as a flat array of nodes. Nodes are
+// referred to by their index, with the root at index 0. Because the root is
+// never anyone's child, a child index of 0 means there is no such prefix
+struct Prefix_trie
+{
+    using Node_id = std::uint32_t;
+    static constexpr Node_id root = 0;
+    static constexpr Node_id none = 0;
+
+    struct Node
+    {
+        std::array<Node_id, ALPHABET_LEN> next{};
+        Letter_mask letters = 0; // letters that have a child in next
+    };
+
+    Array_view<Node> nodes;
+
+    // get the node for the prefix of node followed by c, or none if no word has that prefix
+    Node_id next(const Node_id node, const char c) const
+    {
+        return nodes[node].next[c - 'A'];
+    }
+
+    // build the nodes for a trie of count words, each length letters long, packed together in letters
+    static std::vector<Node> build(const char * letters, const std::size_t count, const std::size_t length)
+    {
+        std::vector<Node> nodes(1);
+        for(std::size_t i = 0; i < count; ++i)
+        {
+            auto node = root;
+            for(std::size_t j = 0; j < length; ++j)
+            {
+                auto c = letters[i * length + j];
+                auto child = nodes[node].next[c - 'A'];
+                if(child == none)
+                {
+                    child = static_cast<Node_id>(nodes.size());
+                    nodes[node].next[c - 'A'] = child;
+                    nodes[node].letters |= Letter_mask{1} << (c - 'A');
+                    nodes.emplace_back();
+                }
+                node = child;
+            }
+        }
+        return nodes;
+    }
+};
+
+// all of the dictionary's words of a single length, in sorted order, along
+// with the letters each uses and a trie of their prefixes
+struct Word_list
+{
+    std::size_t length = 0;
+    Array_view<char> letters;      // words packed end to end, without separators
+    Array_view<Letter_mask> masks;
+    Prefix_trie prefixes;
+
+    std::size_t size() const { return masks.size; }
+    const char * word(const std::size_t i) const { return letters.data + i * length; }
+
+    // index of the length letter word starting at text, which must be in the list
+    std::uint32_t find(const char * text) const
+    {
+        std::size_t low = 0, high = size();
+        while(low < high)
+        {
+            auto mid = low + (high - low) / 2;
+            if(std::memcmp(word(mid), text, length) < 0)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+        return static_cast<std::uint32_t>(low);
+    }
+};
+
+// the letters words are made of, and how each is written. Letters are stored as 'A' + their index, in
+// alphabet order. The default alphabet is A to Z, which are written as themselves and can also be given
+// in lower case. An alphabet file has one letter per line, in order: the spellings that stand for it,
+// separated by spaces, the first of which is how it's output. Spellings are UTF-8, and can be more than
+// one character, as long as none starts another, so a word can be read a byte at a time with no lookahead
+class Alphabet
+{
+public:
+    // normalization tables: for each byte, what it is when read in a given state. Reading starts
+    // in state 0, which is back where it is after each letter. Entries are one of these, a stored
+    // letter, or first_state + the state to read the next byte in, part way through a spelling
+    using Table = std::array<unsigned char, 256>;
+    static constexpr unsigned char reject = 0;        // words with this byte are rejected
+    static constexpr unsigned char skip = 1;          // this byte is removed from words. Only set by Word_filter
+    static constexpr unsigned char first_state = 128; // past the last stored letter, '~'
+
+    Alphabet()
+    {
+        for(char c = 'A'; c <= 'Z'; ++c)
+            add_letter({std::string(1, c), std::string(1, c - 'A' + 'a')});
+        plain = true;
+    }
+
+    // read an alphabet file, or return nullopt after printing what's wrong with it
+    static std::optional<Alphabet> load(const std::string & filename)
+    {
+        std::ifstream file(filename);
+        if(!file)
+        {
+            std::cerr<<"Error opening "<<filename<<": "<<std::strerror(errno)<<std::endl;
+            return std::nullopt;
+        }
+
+        Alphabet alphabet{no_letters};
+        std::string line;
+        while(std::getline(file, line))
+        {
+            std::istringstream line_stream(line);
+            std::vector<std::string> spellings{std::istream_iterator<std::string>{line_stream}, std::istream_iterator<std::string>{}};
+            if(spellings.empty())
+                continue;
+
+            if(alphabet.size() == ALPHABET_LEN)
+            {
+                std::cerr<<filename<<" has more than "<<ALPHABET_LEN<<" letters. Build with a larger WORD_GRID_MAX_LETTERS"<<std::endl;
+                return std::nullopt;
+            }
+            // the output spelling goes in JSON strings as is
+            if(spellings[0].find_first_of("\"\\") != std::string::npos)
+            {
+                std::cerr<<"The first spelling of a letter can't have a quote or backslash in it: "<<spellings[0]<<" in "<<filename<<std::endl;
+                return std::nullopt;
+            }
+            if(auto conflict = alphabet.add_letter(spellings))
+            {
+                std::cerr<<"Spellings can't repeat or start one another: "<<*conflict<<" in "<<filename<<std::endl;
+                return std::nullopt;
+            }
+            if(alphabet.states.size() > 256 - first_state)
+            {
+                std::cerr<<filename<<" has too many letters spelled with more than one byte"<<std::endl;
+                return std::nullopt;
+            }
+        }
+        if(file.bad())
+        {
+            std::cerr<<"Error reading "<<filename<<": "<<std::strerror(errno)<<std::endl;
+            return std::nullopt;
+        }
+        if(alphabet.size() == 0)
+        {
+            std::cerr<<filename<<" has no letters"<<std::endl;
+            return std::nullopt;
+        }
+
+        alphabet.plain = true;
+        for(std::size_t letter = 0; letter < alphabet.size(); ++letter)
+            alphabet.plain = alphabet.plain && alphabet.spellings[letter] == std::string(1, 'A' + letter);
+
+        return std::make_optional(std::move(alphabet));
+    }
+
+    std::size_t size() const { return spellings.size(); }
+
+    // how a letter, counting from 0, is output
+    const std::string & spelling(const int letter) const { return spellings[letter]; }
+
+    // whether every letter is output as the character it's stored as, so words can be output as they're stored
+    bool is_plain() const { return plain; }
+
+    // of every letter's spellings, to tell whether two alphabets read words the same way
+    std::uint64_t get_hash() const { return hash; }
+
+    const std::vector<Table> & get_states() const { return states; }
+
+    // text in stored letters, or nullopt if it isn't made of whole letters
+    std::optional<std::string> normalize(const std::string_view text) const
+    {
+        std::string word;
+        unsigned char state = 0;
+        for(auto c: text)
+        {
+            auto entry = states[state][static_cast<unsigned char>(c)];
+            if(entry == reject)
+                return std::nullopt;
+            if(entry >= first_state)
+            {
+                state = entry - first_state;
+                continue;
+            }
+            word.push_back(entry);
+            state = 0;
+        }
+        return state == 0 ? std::make_optional(word) : std::nullopt;
+    }
 
-const int ALPHABET_LEN = 26;
+private:
+    struct No_letters {};
+    static constexpr No_letters no_letters{};
+    explicit Alphabet(No_letters) {}
+
+    // add the next letter, or return a spelling that conflicts with one already added
+    std::optional<std::string> add_letter(const std::vector<std::string> & letter_spellings)
+    {
+        const auto letter = static_cast<unsigned char>('A' + spellings.size());
+        spellings.push_back(letter_spellings[0]);
+
+        for(const auto & spelling: letter_spellings)
+        {
+            hash = hash_bytes(spelling.data(), spelling.size() + 1, hash);
+
+            std::size_t state = 0;
+            for(std::size_t i = 0; i < spelling.size(); ++i)
+            {
+                auto & entry = states[state][static_cast<unsigned char>(spelling[i])];
+                if(i + 1 == spelling.size())
+                {
+                    if(entry != reject)
+                        return spelling;
+                    entry = letter;
+                }
+                else if(entry == reject)
+                {
+                    entry = static_cast<unsigned char>(first_state + std::min<std::size_t>(states.size(), 255 - first_state));
+                    state = states.size();
+                    states.emplace_back();
+                }
+                else if(entry >= first_state)
+                    state = entry - first_state;
+                else
+                    return spelling;
+            }
+        }
+        hash = hash_bytes("\n", 1, hash);
+        return std::nullopt;
+    }
+
+    std::vector<std::string> spellings;  // how each letter is output
+    std::vector<Table> states{Table{}};  // every entry starts as reject
+    std::uint64_t hash = hash_bytes(nullptr, 0);
+    bool plain = false;
+};
+
+struct Grid_size
+{
+    int width = 0;
+    int height = 0;
+};
 
 struct Args
 {
     bool use_apostrophe = true;
     bool restrict_small_words = true;
     std::string dictionary_filename = "/usr/share/dict/words";
-    int width = 0;
-    int height = 0;
+    std::string alphabet_filename;    // read the letters from this file instead of using A to Z, if set
+    std::string small_words_filename; // the small words to allow instead of the built in list, if set
+    Alphabet alphabet;                // read from alphabet_filename, if given
+    std::string index_filename;       // load words from this index instead of the dictionary, if set
+    std::string build_index_filename; // write an index here and exit, if set
+    bool canonical = false;           // only output one of each grid / transpose pair
+    bool count_only = false;
+    std::uint64_t limit = 0;          // stop each size after this many grids if not 0
+    std::uint64_t random_grids = 0;   // find this many grids of each size in a random order, if not 0
+    std::optional<std::uint64_t> seed; // for random_grids. Picked at random if not given
+    std::string simd = "auto";        // which candidate filter to use: auto, avx512, avx2, or scalar
+    std::string engine = "rows";      // which search to use: rows, adaptive, or dlx
+    bool rare_first = false;          // try words with rarer letters first
+    std::string offload = "none";     // where to solve the last two rows: none, cpu, or cuda
+    std::string format = "text";      // how to output grids: text, binary, or jsonl
+    bool print_stats = false;
+    unsigned int progress_interval = 0; // seconds between progress reports, or 0 for none
+    int shard = 0;                      // search only the shard'th of num_shards pieces, if num_shards isn't 0
+    int num_shards = 0;
+    std::vector<int> top_words;         // search only these top words, if not empty
+    std::string checkpoint_filename;    // save progress here periodically, if set
+    unsigned int checkpoint_interval = 300; // seconds between checkpoints
+    bool resume = false;                // skip work recorded in checkpoint_filename
+    std::string serve_address;          // answer requests on this socket instead of searching sizes, if set
+    std::string cache_directory;        // keep every grid of each finished size here, and output them from here next time, if set
+    unsigned int num_threads = 0;   // 0 to pick automatically
+    bool pin_threads = false;
+    std::vector<int> pin_cpus;      // empty to use every CPU we're allowed to run on
+    std::vector<Grid_size> sizes;   // grid sizes to search, all in the same run
 };
 
+// parse a list of indexes less than size, in the same format as taskset / cpuset: "0-3,8,10-11"
+std::optional<std::vector<int>> parse_index_list(const std::string & list, const int size)
+{
+    std::vector<int> indexes;
+
+    std::size_t pos = 0;
+    while(pos <= list.size())
+    {
+        auto end = list.find(',', pos);
+        if(end == std::string::npos)
+            end = list.size();
+
+        auto range = list.substr(pos, end - pos);
+        auto dash = range.find('-');
+
+        try
+        {
+            std::size_t first_len = 0, last_len = 0;
+            auto first = std::stoi(range.substr(0, dash), &first_len);
+            auto last = first;
+            if(dash != std::string::npos)
+                last = std::stoi(range.substr(dash + 1), &last_len);
+
+            if(first_len != std::min(dash, range.size()) || (dash != std::string::npos && last_len != range.size() - dash - 1)
+                    || first < 0 || last < first || last >= size)
+                return std::nullopt;
+
+            for(auto i = first; i <= last; ++i)
+                indexes.push_back(i);
+        }
+        catch(std::logic_error & e)
+        {
+            return std::nullopt;
+        }
+
+        pos = end + 1;
+    }
+
+    return std::make_optional(indexes);
+}
+
 std::optional<Args> parse_arguments(int argc, char ** argv)
 {
     Args args;
 
+    // values for options without a short form
+    enum: int { OPT_STATS = 256, OPT_BUILD_INDEX, OPT_CANONICAL, OPT_SIMD, OPT_PROGRESS, OPT_CHECKPOINT, OPT_CHECKPOINT_INTERVAL, OPT_RESUME,
+        OPT_SHARD, OPT_TOP_WORDS, OPT_ENGINE, OPT_SERVE, OPT_CACHE, OPT_FORMAT, OPT_RANDOM, OPT_SEED, OPT_RARE_FIRST, OPT_OFFLOAD,
+        OPT_ALPHABET, OPT_SMALL_WORD_LIST };
+
+    auto all_sizes = false;
+
     option longopts[] =
     {
         {"help", no_argument, NULL, 'h'},
         {"dictionary", required_argument, NULL, 'd'},
         {"no-apostrophe", no_argument, NULL, 'n'},
-        {"small-words", no_argument, NULL, 's'}
+        {"small-words", no_argument, NULL, 's'},
+        {"small-word-list", required_argument, NULL, OPT_SMALL_WORD_LIST},
+        {"alphabet", required_argument, NULL, OPT_ALPHABET},
+        {"stats", no_argument, NULL, OPT_STATS},
+        {"threads", required_argument, NULL, 't'},
+        {"pin", optional_argument, NULL, 'p'},
+        {"index", required_argument, NULL, 'i'},
+        {"build-index", required_argument, NULL, OPT_BUILD_INDEX},
+        {"all", no_argument, NULL, 'a'},
+        {"canonical", no_argument, NULL, OPT_CANONICAL},
+        {"simd", required_argument, NULL, OPT_SIMD},
+        {"engine", required_argument, NULL, OPT_ENGINE},
+        {"rare-first", no_argument, NULL, OPT_RARE_FIRST},
+        {"offload", required_argument, NULL, OPT_OFFLOAD},
+        {"format", required_argument, NULL, OPT_FORMAT},
+        {"progress", optional_argument, NULL, OPT_PROGRESS},
+        {"checkpoint", required_argument, NULL, OPT_CHECKPOINT},
+        {"checkpoint-interval", required_argument, NULL, OPT_CHECKPOINT_INTERVAL},
+        {"resume", no_argument, NULL, OPT_RESUME},
+        {"shard", required_argument, NULL, OPT_SHARD},
+        {"top-words", required_argument, NULL, OPT_TOP_WORDS},
+        {"serve", required_argument, NULL, OPT_SERVE},
+        {"cache", required_argument, NULL, OPT_CACHE},
+        {"count", no_argument, NULL, 'c'},
+        {"limit", required_argument, NULL, 'l'},
+        {"random", required_argument, NULL, OPT_RANDOM},
+        {"seed", required_argument, NULL, OPT_SEED},
+        {NULL, 0, NULL, 0}
     };
 
     int opt = 0;
@@ -66,10 +496,41 @@ std::optional<Args> parse_arguments(int argc, char ** argv)
     if(sep_pos != std::string::npos)
         prog_name = prog_name.substr(sep_pos + 1);
 
-    auto usage = "usage: " + prog_name + " [-h] [-n] [-s] [-d DICTONARY] WIDTH HEIGHT\n";
+    auto usage = "usage: " + prog_name + " [-h] [-n] [-s | --small-word-list FILE] [--alphabet FILE]\n"
+        "       " + std::string(prog_name.size(), ' ') + " [-d DICTONARY] [-i INDEX] [-t THREADS] [-p[CPUS]]\n"
+        "       " + std::string(prog_name.size(), ' ') + " [-c] [-l LIMIT | --random N [--seed SEED]] [--canonical]\n"
+        "       " + std::string(prog_name.size(), ' ') + " [--engine ENGINE] [--rare-first] [--offload DEVICE]\n"
+        "       " + std::string(prog_name.size(), ' ') + " [--simd FILTER] [--format FORMAT]\n"
+        "       " + std::string(prog_name.size(), ' ') + " [--stats] [--progress[=SECONDS]] [--cache DIR]\n"
+        "       " + std::string(prog_name.size(), ' ') + " [--checkpoint FILE [--checkpoint-interval SECONDS] [--resume]]\n"
+        "       " + std::string(prog_name.size(), ' ') + " [--shard K/N | --top-words LIST]\n"
+        "       " + std::string(prog_name.size(), ' ') + " {-a | WIDTH HEIGHT [WIDTH HEIGHT …]}\n"
+        "       " + prog_name + " [-n] [-s | --small-word-list FILE] [--alphabet FILE] [-d DICTONARY]\n"
+        "       " + std::string(prog_name.size(), ' ') + " --build-index INDEX\n"
+        "       " + prog_name + " [-n] [-s | --small-word-list FILE] [--alphabet FILE] [-d DICTONARY]\n"
+        "       " + std::string(prog_name.size(), ' ') + " [-i INDEX] [-t THREADS] [-p[CPUS]]\n"
+        "       " + std::string(prog_name.size(), ' ') + " [-c] [-l LIMIT] [--canonical] [--engine ENGINE] [--simd FILTER]\n"
+        "       " + std::string(prog_name.size(), ' ') + " --serve ADDRESS\n";
+
+    auto convert_dim = [](auto & dim, auto & name)-> auto
+    {
+        try
+        {
+            return std::make_optional(std::stoi(dim));
+        }
+        catch(std::invalid_argument &e)
+        {
+            std::cerr<<"Invalid integer for "<<name<<" argument: "<<dim<<"\n";
+        }
+        catch(std::out_of_range &e)
+        {
+            std::cerr<<"Value too large for "<<name<<" argument: "<<dim<<"\n";
+        }
+        return std::optional<int>();
+    };
 
     int ind = 0;
-    while((opt = getopt_long(argc, argv, ":hd:sn", longopts, &ind)) != -1)
+    while((opt = getopt_long(argc, argv, ":hd:snt:p::i:acl:", longopts, &ind)) != -1)
     {
         switch(opt)
         {
@@ -82,20 +543,332 @@ std::optional<Args> parse_arguments(int argc, char ** argv)
             case 's':
                 args.restrict_small_words = false;
                 break;
+            case OPT_SMALL_WORD_LIST:
+                args.small_words_filename = optarg;
+                break;
+            case OPT_ALPHABET:
+                args.alphabet_filename = optarg;
+                break;
+            case 'i':
+                args.index_filename = optarg;
+                break;
+            case 'a':
+                all_sizes = true;
+                break;
+            case OPT_BUILD_INDEX:
+                args.build_index_filename = optarg;
+                break;
+            case 'c':
+                args.count_only = true;
+                break;
+            case 'l':
+            {
+                auto limit = convert_dim(optarg, "limit");
+                if(!limit)
+                    return std::nullopt;
+                if(*limit <= 0)
+                {
+                    std::cerr<<"Limit is too small. Must be > 0\n";
+                    return std::nullopt;
+                }
+                args.limit = *limit;
+                break;
+            }
+            case OPT_RANDOM:
+            {
+                auto random_grids = convert_dim(optarg, "random");
+                if(!random_grids)
+                    return std::nullopt;
+                if(*random_grids <= 0)
+                {
+                    std::cerr<<"Random grid count is too small. Must be > 0\n";
+                    return std::nullopt;
+                }
+                args.random_grids = *random_grids;
+                break;
+            }
+            case OPT_SEED:
+                try
+                {
+                    std::size_t pos = 0;
+                    args.seed = std::stoull(optarg, &pos);
+                    if(pos != std::strlen(optarg) || optarg[0] == '-')
+                        throw std::invalid_argument{optarg};
+                }
+                catch(std::logic_error & e)
+                {
+                    std::cerr<<"Invalid seed: "<<optarg<<". Must be a non-negative integer\n";
+                    return std::nullopt;
+                }
+                break;
+            case OPT_CANONICAL:
+                args.canonical = true;
+                break;
+            case OPT_SIMD:
+                args.simd = optarg;
+                if(args.simd != "auto" && args.simd != "avx512" && args.simd != "avx2" && args.simd != "scalar")
+                {
+                    std::cerr<<"Unknown filter: "<<args.simd<<". Must be auto, avx512, avx2, or scalar\n";
+                    return std::nullopt;
+                }
+                break;
+            case OPT_ENGINE:
+                args.engine = optarg;
+                if(args.engine != "rows" && args.engine != "adaptive" && args.engine != "dlx")
+                {
+                    std::cerr<<"Unknown engine: "<<args.engine<<". Must be rows, adaptive, or dlx\n";
+                    return std::nullopt;
+                }
+                break;
+            case OPT_RARE_FIRST:
+                args.rare_first = true;
+                break;
+            case OPT_OFFLOAD:
+                args.offload = optarg;
+                if(args.offload != "none" && args.offload != "cpu" && args.offload != "cuda")
+                {
+                    std::cerr<<"Unknown offload device: "<<args.offload<<". Must be none, cpu, or cuda\n";
+                    return std::nullopt;
+                }
+#ifndef WORD_GRID_CUDA
+                if(args.offload == "cuda")
+                {
+                    std::cerr<<"word_grid was built without CUDA. Configure with -DWORD_GRID_CUDA=ON for --offload cuda\n";
+                    return std::nullopt;
+                }
+#endif
+                break;
+            case OPT_FORMAT:
+                args.format = optarg;
+                if(args.format != "text" && args.format != "binary" && args.format != "jsonl")
+                {
+                    std::cerr<<"Unknown format: "<<args.format<<". Must be text, binary, or jsonl\n";
+                    return std::nullopt;
+                }
+                break;
+            case OPT_STATS:
+                args.print_stats = true;
+                break;
+            case OPT_PROGRESS:
+                args.progress_interval = 1;
+                if(optarg)
+                {
+                    auto interval = convert_dim(optarg, "progress");
+                    if(!interval)
+                        return std::nullopt;
+                    if(*interval <= 0)
+                    {
+                        std::cerr<<"Progress interval is too small. Must be > 0\n";
+                        return std::nullopt;
+                    }
+                    args.progress_interval = *interval;
+                }
+                break;
+            case OPT_CHECKPOINT:
+                args.checkpoint_filename = optarg;
+                break;
+            case OPT_CHECKPOINT_INTERVAL:
+            {
+                auto interval = convert_dim(optarg, "checkpoint interval");
+                if(!interval)
+                    return std::nullopt;
+                if(*interval <= 0)
+                {
+                    std::cerr<<"Checkpoint interval is too small. Must be > 0\n";
+                    return std::nullopt;
+                }
+                args.checkpoint_interval = *interval;
+                break;
+            }
+            case OPT_RESUME:
+                args.resume = true;
+                break;
+            case OPT_SHARD:
+            {
+                std::string shard = optarg;
+                auto slash = shard.find('/');
+                if(slash == std::string::npos)
+                {
+                    std::cerr<<"Invalid shard: "<<shard<<". Must be K/N\n";
+                    return std::nullopt;
+                }
+
+                auto k_str = shard.substr(0, slash);
+                auto n_str = shard.substr(slash + 1);
+                auto k = convert_dim(k_str, "shard");
+                auto n = convert_dim(n_str, "shard count");
+                if(!k || !n)
+                    return std::nullopt;
+                if(*n <= 0 || *k <= 0 || *k > *n)
+                {
+                    std::cerr<<"Invalid shard: "<<shard<<". Must have 0 < K ≤ N\n";
+                    return std::nullopt;
+                }
+                args.shard = *k;
+                args.num_shards = *n;
+                break;
+            }
+            case OPT_TOP_WORDS:
+            {
+                auto top_words = parse_index_list(optarg, std::numeric_limits<int>::max());
+                if(!top_words)
+                {
+                    std::cerr<<"Invalid top word list: "<<optarg<<"\n";
+                    return std::nullopt;
+                }
+                args.top_words = *top_words;
+                break;
+            }
+            case OPT_SERVE:
+                args.serve_address = optarg;
+                break;
+            case OPT_CACHE:
+                args.cache_directory = optarg;
+                break;
+            case 't':
+            {
+                auto num_threads = convert_dim(optarg, "threads");
+                if(!num_threads)
+                    return std::nullopt;
+                if(*num_threads <= 0)
+                {
+                    std::cerr<<"Thread count is too small. Must be > 0\n";
+                    return std::nullopt;
+                }
+                args.num_threads = *num_threads;
+                break;
+            }
+            case 'p':
+                args.pin_threads = true;
+                if(optarg)
+                {
+                    auto cpus = parse_index_list(optarg, CPU_SETSIZE);
+                    if(!cpus)
+                    {
+                        std::cerr<<"Invalid CPU list: "<<optarg<<"\n";
+                        return std::nullopt;
+                    }
+                    args.pin_cpus = *cpus;
+                }
+                break;
             case 'h':
                 std::cout<<usage<<"\n";
                 std::cout<<
                     "Word grid generator\n\n"
                     "Positional arguments:\n"
                     "  WIDTH HEIGHT          Width and height of grid to generate.\n"
-                  u8"                        Width × Height must be ≤ "<<ALPHABET_LEN<<"\n\n"
+                  u8"                        Width × Height must be ≤ the number of letters\n"
+                    "                        in the alphabet (26 for A to Z). Give more than\n"
+                    "                        one pair to search several sizes in one run\n\n"
                     "Optional arguments\n"
                     "  -h, --help            Show this help message and exit\n"
+                  u8"  -a, --all             Search every size from 2 × 2 up, with\n"
+                  u8"                        Width × Height ≤ the number of letters\n"
                     "  -n, --no-apostrophe   Don't generate words with apostrophes\n"
                   u8"  -s, --small-words     Dont' restrict small (≤ 2 letters) to\n"
                     "                        internally defined list\n"
+                    "  --small-word-list FILE\n"
+                    "                        Restrict small words to the ones in FILE, one per\n"
+                    "                        line, instead of the internally defined list\n"
+                    "  --alphabet FILE       Letters words are made of, instead of A to Z: one\n"
+                    "                        letter per line, in order, as the UTF-8 spellings\n"
+                    "                        that stand for it, separated by spaces, like\n"
+                    u8"                        \"Ä ä\". Output uses the first. No spelling may\n"
+                    "                        start another. Up to "<<ALPHABET_LEN<<" letters, set when built\n"
                     " --dictionary DICTIONARY,\n"
-                    "  -d DICTIONARY         Dictionary file (defaults to /usr/share/dict/words)\n";
+                    "  -d DICTIONARY         Dictionary file (defaults to /usr/share/dict/words)\n"
+                    " --index INDEX,\n"
+                    "  -i INDEX              Load words from an index written by --build-index\n"
+                    "                        instead of reading the dictionary\n"
+                    "  --build-index INDEX   Filter the dictionary, write the words of every\n"
+                    "                        length to INDEX, and exit. -n, -s, and --alphabet\n"
+                    "                        given here must also be given when using the\n"
+                    "                        index\n"
+                    " --threads THREADS,\n"
+                    "  -t THREADS            Number of search threads (defaults to one per\n"
+                    "                        hardware thread, or one per pinned CPU)\n"
+                    " --pin[=CPUS],\n"
+                    "  -p[CPUS]              Pin each search thread to its own CPU, chosen in\n"
+                    "                        order from CPUS (like 0-3,8-11). Defaults to the\n"
+                    "                        CPUs this process is allowed to run on\n"
+                    "  -c, --count           Print how many grids there are of each size,\n"
+                    "                        instead of the grids themselves\n"
+                    " --limit LIMIT,\n"
+                    "  -l LIMIT              Stop searching each size after finding LIMIT\n"
+                    "                        grids\n"
+                    "  --random N            Find N grids of each size, in a random order:\n"
+                    "                        top row words are shuffled, the words below them\n"
+                    "                        are tried in a random order, and only the first\n"
+                    "                        grid found with each top row is output.\n"
+                    "                        Prints the time to the first grid to stderr\n"
+                    "  --seed SEED           Seed for --random. Picked at random, and printed\n"
+                    "                        to stderr, if not given. With -t 1, the same seed\n"
+                    "                        always gives the same grids\n"
+                    "  --canonical           Output only one grid of each grid / transpose\n"
+                  u8"                        pair. Square grids are pruned during the search,\n"
+                  u8"                        and H × W is skipped when W × H is also searched\n"
+                    "  --engine ENGINE       How to search: rows (default) fills rows top to\n"
+                    "                        bottom. adaptive fills the next row or the next\n"
+                    "                        column, whichever has fewer words that fit. It's\n"
+                    "                        often much faster for grids taller than they are\n"
+                    "                        wide, and slower for wide ones. dlx solves it\n"
+                    "                        as an exact cover problem with dancing links,\n"
+                    "                        filling whichever line has the fewest words left\n"
+                    "  --rare-first          Try words with rare letters first, so grids that\n"
+                    "                        need them are found sooner with -l. Changes the\n"
+                    "                        order grids are output in, not which are found.\n"
+                    "                        Only for --engine rows\n"
+                    "  --offload DEVICE      Solve the last two rows of each grid in batches on\n"
+                    "                        DEVICE: none (default), cpu, or cuda, if built\n"
+                    "                        with it. cpu runs the batches on the search\n"
+                    "                        threads, to check them against the normal search.\n"
+                    "                        Only for --engine rows, and not with -l or\n"
+                    "                        --random. --stats doesn't count the last two rows\n"
+                    "  --format FORMAT       How to output grids: text (default) prints each\n"
+                    "                        row on a line, with a blank line after each grid.\n"
+                    "                        jsonl prints a JSON object per grid, or per size\n"
+                    "                        with -c. binary writes a header listing the sizes\n"
+                    "                        then each grid as varint indexes of its rows into\n"
+                    "                        the row length's sorted word list. Can't be used\n"
+                    "                        with -c\n"
+                    "  --simd FILTER         Candidate filter to use: auto (default), avx512,\n"
+                    "                        avx2, or scalar\n"
+                    "  --stats               Print search statistics per row and per thread\n"
+                    "                        to stderr when done\n"
+                    "  --progress[=SECONDS]  Print how far along the search is to stderr every\n"
+                    "                        SECONDS seconds (default 1)\n"
+                    "  --cache DIR           Save every grid of each size searched in full to\n"
+                    "                        DIR, created if needed, and output them from there\n"
+                    "                        instead of searching again, as long as the\n"
+                    "                        dictionary's words, -n, -s, and --canonical are\n"
+                    "                        the same. Grids are saved as the indexes of their\n"
+                    "                        rows' words, so the files stay small\n"
+                    "  --checkpoint FILE     Save which top words have been searched to FILE\n"
+                    "                        periodically, and when done\n"
+                    "  --checkpoint-interval SECONDS\n"
+                    "                        Seconds between checkpoints (default 300)\n"
+                    "  --resume              Skip the work saved in the --checkpoint FILE by an\n"
+                    "                        earlier run. Grids found after the last\n"
+                    "                        checkpoint are output again\n"
+                    "  --shard K/N           Split the top row words of each size into N\n"
+                    "                        pieces of about the same estimated work, and\n"
+                    "                        search only the Kth. Output from shards 1 to N\n"
+                    "                        with -t 1, concatenated, is the same as the\n"
+                    "                        output of a single -t 1 run\n"
+                    "  --top-words LIST      Search only the top row words at these indexes\n"
+                    "                        (like 0-99,150) in each size's sorted word list\n"
+                    "  --serve ADDRESS       Load the dictionary once, then answer requests on\n"
+                    "                        a socket until killed. ADDRESS is a Unix socket\n"
+                    "                        path if it has a '/', otherwise [HOST:]PORT for TCP\n"
+                    "                        (HOST defaults to 127.0.0.1). Each request is a\n"
+                    "                        line: WIDTH HEIGHT [limit=N] [seed=S] [timeout=MS]\n"
+                    "                        [count]. The reply is the grids, then \"ok N\" or,\n"
+                    "                        if the deadline (default 10000 ms) passed first,\n"
+                    "                        \"timeout N\", or \"error: MESSAGE\". seed=S\n"
+                    "                        searches in a random order, as --random does.\n"
+                    "                        -c and -l set the defaults for count and limit.\n"
+                    "                        Requests run concurrently on one pool of THREADS\n"
+                    "                        threads, and complete replies are cached\n";
                 return std::nullopt;
             case ':':
                 std::cerr<<"Argument required for "<<(char)optopt<<"\n";
@@ -109,245 +882,4798 @@ std::optional<Args> parse_arguments(int argc, char ** argv)
         }
     }
 
-    if(argc - optind < 2)
+    // sizes are checked against the letters there are to fill them with
+    if(!args.alphabet_filename.empty())
     {
-        std::cerr<<"Missing arguments\n";
+        auto alphabet = Alphabet::load(args.alphabet_filename);
+        if(!alphabet)
+            return std::nullopt;
+        args.alphabet = std::move(*alphabet);
+    }
+    const auto num_letters = static_cast<int>(args.alphabet.size());
+
+    if(!args.restrict_small_words && !args.small_words_filename.empty())
+    {
+        std::cerr<<"Only one of -s and --small-word-list can be given\n";
         std::cerr<<usage;
         return std::nullopt;
     }
 
-    if(argc - optind > 2)
+    if(args.num_shards != 0 && !args.top_words.empty())
     {
-        std::cerr<<"Too many arguments\n";
+        std::cerr<<"Only one of --shard and --top-words can be given\n";
         std::cerr<<usage;
         return std::nullopt;
     }
 
-    auto convert_dim = [](auto & dim, auto & name)-> auto
+    if(!args.cache_directory.empty() && (args.num_shards != 0 || !args.top_words.empty() || !args.checkpoint_filename.empty()
+                || !args.serve_address.empty()))
     {
-        try
-        {
-            return std::make_optional(std::stoi(dim));
-        }
-        catch(std::invalid_argument &e)
-        {
-            std::cerr<<"Invalid integer for "<<name<<" argument: "<<dim<<"\n";
-        }
-        catch(std::out_of_range &e)
-        {
-            std::cerr<<"Value too large for "<<name<<" argument: "<<dim<<"\n";
-        }
-        return std::optional<int>();
-    };
-
-    auto width = convert_dim(argv[optind], "width");
-    auto height = convert_dim(argv[optind + 1], "height");
-
-    if(!width || !height)
+        std::cerr<<"--cache can't be used with --shard, --top-words, --checkpoint, or --serve\n";
+        std::cerr<<usage;
         return std::nullopt;
+    }
 
-    args.width = *width;
-    args.height = *height;
-
-    if(args.width <= 0)
+    if(args.resume && args.checkpoint_filename.empty())
     {
-        std::cerr<<"Width is too small. Must be > 0\n";
+        std::cerr<<"--resume needs a --checkpoint FILE to resume from\n";
+        std::cerr<<usage;
         return std::nullopt;
     }
 
-    if(args.height <= 0)
+    if(args.seed && args.random_grids == 0)
     {
-        std::cerr<<"Height is too small. Must be > 0\n";
+        std::cerr<<"--seed is only used with --random\n";
+        std::cerr<<usage;
         return std::nullopt;
     }
 
-    if(args.width * args.height > ALPHABET_LEN)
+    if(args.random_grids != 0 && (args.limit != 0 || args.engine != "rows" || !args.cache_directory.empty()
+                || !args.checkpoint_filename.empty() || !args.serve_address.empty()))
     {
-        std::cerr<<u8"Width × Height is too large. Must be ≤ "<<ALPHABET_LEN<<"\n";
+        std::cerr<<"--random can't be used with -l, --engine adaptive or dlx, --cache, --checkpoint, or --serve\n";
+        std::cerr<<usage;
         return std::nullopt;
     }
 
-    return std::make_optional(args);
+    if(args.rare_first && (args.engine != "rows" || args.random_grids != 0))
+    {
+        std::cerr<<"--rare-first can't be used with --engine adaptive or dlx, or --random\n";
+        std::cerr<<usage;
+        return std::nullopt;
+    }
+
+    if(args.offload != "none" && (args.engine != "rows" || args.limit != 0 || args.random_grids != 0 || !args.serve_address.empty()))
+    {
+        std::cerr<<"--offload can't be used with --engine adaptive or dlx, -l, --random, or --serve\n";
+        std::cerr<<usage;
+        return std::nullopt;
+    }
+
+    if(args.format == "binary" && args.count_only)
+    {
+        std::cerr<<"--format binary can't be used with -c\n";
+        std::cerr<<usage;
+        return std::nullopt;
+    }
+
+    if(!args.serve_address.empty())
+    {
+        if(args.format != "text")
+        {
+            std::cerr<<"--serve only uses text output. --format can't be given\n";
+            std::cerr<<usage;
+            return std::nullopt;
+        }
+        if(all_sizes || !args.build_index_filename.empty() || !args.checkpoint_filename.empty() || args.num_shards != 0
+                || !args.top_words.empty() || args.progress_interval > 0 || args.print_stats)
+        {
+            std::cerr<<"--serve can't be used with -a, --build-index, --checkpoint, --shard, --top-words, --progress, or --stats\n";
+            std::cerr<<usage;
+            return std::nullopt;
+        }
+    }
+
+    if(!args.build_index_filename.empty() || !args.serve_address.empty())
+    {
+        if(argc - optind > 0)
+        {
+            std::cerr<<"Too many arguments\n";
+            std::cerr<<usage;
+            return std::nullopt;
+        }
+        return std::make_optional(args);
+    }
+
+    if(all_sizes)
+    {
+        if(argc - optind > 0)
+        {
+            std::cerr<<"Too many arguments\n";
+            std::cerr<<usage;
+            return std::nullopt;
+        }
+
+        for(int width = 2; width <= num_letters / 2; ++width)
+        {
+            for(int height = 2; width * height <= num_letters; ++height)
+                args.sizes.push_back({width, height});
+        }
+
+        return std::make_optional(args);
+    }
+
+    if(argc - optind < 2)
+    {
+        std::cerr<<"Missing arguments\n";
+        std::cerr<<usage;
+        return std::nullopt;
+    }
+
+    if((argc - optind) % 2 != 0)
+    {
+        std::cerr<<"Missing height argument\n";
+        std::cerr<<usage;
+        return std::nullopt;
+    }
+
+    for(int i = optind; i < argc; i += 2)
+    {
+        auto width = convert_dim(argv[i], "width");
+        auto height = convert_dim(argv[i + 1], "height");
+
+        if(!width || !height)
+            return std::nullopt;
+
+        if(*width <= 0)
+        {
+            std::cerr<<"Width is too small. Must be > 0\n";
+            return std::nullopt;
+        }
+
+        if(*height <= 0)
+        {
+            std::cerr<<"Height is too small. Must be > 0\n";
+            return std::nullopt;
+        }
+
+        if(*width * *height > num_letters)
+        {
+            std::cerr<<u8"Width × Height is too large. Must be ≤ "<<num_letters<<", the number of letters in the alphabet\n";
+            return std::nullopt;
+        }
+
+        args.sizes.push_back({*width, *height});
+    }
+
+    return std::make_optional(args);
 }
 
-std::optional<std::tuple<std::vector<std::string>, std::vector<std::unordered_set<std::string>>>>
-get_word_lists(const Args & args)
+// words of every length we need, grouped by length. The word lists either
+// point into vectors owned by the Dictionary, or into a mapped index file
+class Dictionary
 {
-    std::ifstream dictionary(args.dictionary_filename);
-    try
+public:
+    Dictionary(const bool use_apostrophe, const bool restrict_small_words, Alphabet alphabet):
+        use_apostrophe{use_apostrophe},
+        restrict_small_words{restrict_small_words},
+        alphabet{std::move(alphabet)}
+    {
+        for(std::size_t length = 0; length < lists.size(); ++length)
+            set_words(length, {}, 0);
+    }
+
+    Dictionary(const Dictionary &) = delete;
+    Dictionary(Dictionary &&) = default;
+    Dictionary & operator=(const Dictionary &) = delete;
+    Dictionary & operator=(Dictionary &&) = default;
+
+    // replace the words of a given length with count words packed together in letters. The words must be sorted
+    void set_words(const std::size_t length, std::vector<char> letters, const std::size_t count)
     {
-        dictionary.exceptions(std::ifstream::failbit | std::ifstream::badbit); // throw on error OR failure
+        auto & store = storage[length];
+
+        store.letters = std::move(letters);
+        store.masks.clear();
+        store.masks.reserve(count);
+
+        for(std::size_t i = 0; i < count; ++i)
+            store.masks.push_back(get_letter_mask(&store.letters[i * length], length));
+
+        // words are inserted in sorted order, so node numbering is reproducible
+        store.nodes = Prefix_trie::build(store.letters.data(), count, length);
+
+        auto & list = lists[length];
+        list.length = length;
+        list.letters = Array_view<char>{store.letters};
+        list.masks = Array_view<Letter_mask>{store.masks};
+        list.prefixes.nodes = Array_view<Prefix_trie::Node>{store.nodes};
     }
-    catch(std::system_error & e)
+
+    const Word_list & get_words(const std::size_t length) const { return lists[length]; }
+    bool get_use_apostrophe() const { return use_apostrophe; }
+    bool get_restrict_small_words() const { return restrict_small_words; }
+    const Alphabet & get_alphabet() const { return alphabet; }
+
+    // write every word list to a binary index file, which can be mapped back in by load_index
+    bool write_index(const std::string & filename) const
     {
-        std::cerr<<"Error opening "<<args.dictionary_filename<<": "<<std::strerror(errno)<<std::endl;
-        return std::nullopt;
+        Index_header header;
+        std::copy(std::begin(index_magic), std::end(index_magic), header.magic.begin());
+        header.flags = (use_apostrophe ? index_use_apostrophe : 0) | (restrict_small_words ? index_restrict_small_words : 0);
+        header.alphabet_hash = alphabet.get_hash();
+
+        // lay out each list's arrays after the header, each starting on a cache line
+        auto offset = index_align(sizeof(header));
+        for(std::size_t length = 0; length < lists.size(); ++length)
+        {
+            const auto & list = lists[length];
+            auto & section = header.lists[length];
+
+            section.num_words = list.size();
+            section.letters_offset = offset;
+            offset = index_align(offset + list.letters.size * sizeof(char));
+            section.masks_offset = offset;
+            offset = index_align(offset + list.masks.size * sizeof(Letter_mask));
+            section.num_nodes = list.prefixes.nodes.size;
+            section.nodes_offset = offset;
+            offset = index_align(offset + list.prefixes.nodes.size * sizeof(Prefix_trie::Node));
+        }
+
+        std::ofstream index(filename, std::ios::binary);
+        try
+        {
+            index.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+
+            std::uint64_t pos = 0;
+            auto write = [&index, &pos](const std::uint64_t offset, const void * data, const std::size_t size)
+            {
+                static const std::array<char, index_alignment> padding{};
+                index.write(padding.data(), offset - pos);
+                index.write(static_cast<const char *>(data), size);
+                pos = offset + size;
+            };
+
+            write(0, &header, sizeof(header));
+            for(std::size_t length = 0; length < lists.size(); ++length)
+            {
+                const auto & list = lists[length];
+                const auto & section = header.lists[length];
+
+                write(section.letters_offset, list.letters.data, list.letters.size * sizeof(char));
+                write(section.masks_offset, list.masks.data, list.masks.size * sizeof(Letter_mask));
+                write(section.nodes_offset, list.prefixes.nodes.data, list.prefixes.nodes.size * sizeof(Prefix_trie::Node));
+            }
+        }
+        catch(std::system_error & e)
+        {
+            std::cerr<<"Error writing "<<filename<<": "<<std::strerror(errno)<<std::endl;
+            return false;
+        }
+
+        return true;
     }
 
-    try
+    // map in an index file written by write_index with the same alphabet. The word
+    // lists point straight into the mapping, so nothing is parsed or copied
+    static std::optional<Dictionary> load_index(const std::string & filename, const Alphabet & alphabet)
     {
-        dictionary.exceptions(std::ifstream::badbit); // only throw on error
+        auto fd = open(filename.c_str(), O_RDONLY);
+        if(fd < 0)
+        {
+            std::cerr<<"Error opening "<<filename<<": "<<std::strerror(errno)<<std::endl;
+            return std::nullopt;
+        }
+
+        struct stat file_stat;
+        if(fstat(fd, &file_stat) < 0)
+        {
+            std::cerr<<"Error reading "<<filename<<": "<<std::strerror(errno)<<std::endl;
+            close(fd);
+            return std::nullopt;
+        }
+
+        const auto size = static_cast<std::size_t>(file_stat.st_size);
+        if(size < sizeof(Index_header))
+        {
+            std::cerr<<filename<<" is not a word_grid index"<<std::endl;
+            close(fd);
+            return std::nullopt;
+        }
 
-        std::unordered_set<std::string> row_words;
-        std::unordered_set<std::string> col_words;
+        auto data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if(data == MAP_FAILED)
+        {
+            std::cerr<<"Error mapping "<<filename<<": "<<std::strerror(errno)<<std::endl;
+            return std::nullopt;
+        }
 
-        std::string word;
-        while(std::getline(dictionary, word, '\n'))
+        const auto & header = *static_cast<const Index_header *>(data);
+        if(!std::equal(std::begin(index_magic), std::end(index_magic), header.magic.begin())
+                || header.byte_order != index_byte_order || header.version != index_version
+                || header.alphabet_len != ALPHABET_LEN)
+        {
+            std::cerr<<filename<<" is not a word_grid index, or was written by a different version or machine"<<std::endl;
+            munmap(data, size);
+            return std::nullopt;
+        }
+
+        if(header.alphabet_hash != alphabet.get_hash())
+        {
+            std::cerr<<filename<<" was built with a different --alphabet"<<std::endl;
+            munmap(data, size);
+            return std::nullopt;
+        }
+
+        Dictionary dict(header.flags & index_use_apostrophe, header.flags & index_restrict_small_words, alphabet);
+        dict.mapping = Mapping(data, Unmapper{size});
+
+        // make sure each array lies within the file before pointing at it
+        auto get_view = [data, size](auto & view, const std::uint64_t offset, const std::uint64_t count)
+        {
+            using T = std::remove_reference_t<decltype(view[0])>;
+            if(offset % index_alignment != 0 || offset > size || count > (size - offset) / sizeof(T))
+                return false;
+            view = {reinterpret_cast<const T *>(static_cast<const char *>(data) + offset), count};
+            return true;
+        };
+
+        for(std::size_t length = 0; length < dict.lists.size(); ++length)
+        {
+            const auto & section = header.lists[length];
+            auto & list = dict.lists[length];
+
+            list.length = length;
+            if(section.num_words > std::numeric_limits<std::uint32_t>::max()
+                    || !get_view(list.letters, section.letters_offset, section.num_words * length)
+                    || !get_view(list.masks, section.masks_offset, section.num_words)
+                    || !get_view(list.prefixes.nodes, section.nodes_offset, section.num_nodes)
+                    || section.num_nodes == 0)
+            {
+                std::cerr<<filename<<" is corrupt"<<std::endl;
+                return std::nullopt;
+            }
+        }
+
+        return std::make_optional(std::move(dict));
+    }
+
+private:
+    static constexpr char index_magic[8] = {'W', 'G', 'R', 'I', 'D', 'I', 'D', 'X'};
+    static constexpr std::uint32_t index_byte_order = 0x01020304;
+    static constexpr std::uint32_t index_version = 3;
+    static constexpr std::size_t index_alignment = 64;
+    static constexpr std::uint32_t index_use_apostrophe = 1 << 0;
+    static constexpr std::uint32_t index_restrict_small_words = 1 << 1;
+
+    static std::uint64_t index_align(const std::uint64_t offset)
+    {
+        return (offset + index_alignment - 1) / index_alignment * index_alignment;
+    }
+
+    // location of one word list's arrays within the index file, as byte offsets from the start of the file
+    struct Index_section
+    {
+        std::uint64_t num_words = 0;
+        std::uint64_t letters_offset = 0;
+        std::uint64_t masks_offset = 0;
+        std::uint64_t num_nodes = 0;
+        std::uint64_t nodes_offset = 0;
+    };
+
+    struct Index_header
+    {
+        std::array<char, sizeof(index_magic)> magic{};
+        std::uint32_t byte_order = index_byte_order; // to catch files written on a machine with different endianness
+        std::uint32_t version = index_version;
+        std::uint32_t alphabet_len = ALPHABET_LEN;
+        std::uint32_t flags = 0;
+        std::uint64_t alphabet_hash = 0; // of the Alphabet the words were read with
+        std::array<Index_section, ALPHABET_LEN + 1> lists; // indexed by word length
+    };
+
+    struct Storage
+    {
+        std::vector<char> letters;
+        std::vector<Letter_mask> masks;
+        std::vector<Prefix_trie::Node> nodes;
+    };
+
+    struct Unmapper
+    {
+        std::size_t size;
+        void operator()(void * data) const { munmap(data, size); }
+    };
+    using Mapping = std::unique_ptr<void, Unmapper>;
+
+    bool use_apostrophe;
+    bool restrict_small_words;
+    Alphabet alphabet;
+
+    std::array<Word_list, ALPHABET_LEN + 1> lists; // indexed by word length
+    std::array<Storage, ALPHABET_LEN + 1> storage; // backing for lists read from a dictionary file
+    Mapping mapping;                               // backing for lists loaded from an index
+};
+
+// normalizes and filters the lines of a dictionary, with one table lookup per byte
+class Word_filter
+{
+public:
+    // words for each length, packed together. The empty word is stored as one placeholder character
+    using Words = std::array<std::vector<char>, ALPHABET_LEN + 1>;
+
+    // small_words are the words of 2 letters or less to keep when restricting them, in stored letters
+    Word_filter(const Args & args, const Alphabet & alphabet, std::vector<std::string> small_words, const std::vector<std::size_t> & lengths):
+        states{alphabet.get_states()},
+        small_words{std::move(small_words)},
+        restrict_small_words{args.restrict_small_words}
+    {
+        if(args.use_apostrophe && states[0]['\''] == Alphabet::reject)
+            states[0]['\''] = Alphabet::skip;
+
+        std::sort(this->small_words.begin(), this->small_words.end());
+
+        for(auto length: lengths)
+            keep_length[length] = true;
+    }
+
+    // filter every line in [begin, end), adding the words we keep to words. The range must start at
+    // the beginning of a line, and end at the end of one
+    void parse(const char * begin, const char * const end, Words & words) const
+    {
+        const auto * table = states.data();
+        while(begin < end)
         {
-            if(args.use_apostrophe)
-                word.erase(std::remove(word.begin(), word.end(), '\''), word.end());
+            auto line_end = static_cast<const char *>(std::memchr(begin, '\n', end - begin));
+            if(!line_end)
+                line_end = end;
 
-            std::vector<char> seen;
+            std::array<char, ALPHABET_LEN> word;
+            std::size_t length = 0;
+            Letter_mask seen = 0;
+            unsigned char state = 0;
 
             auto skip_word = false;
-            for(auto &c: word)
+            for(auto c = begin; c < line_end; ++c)
             {
-                c = std::toupper(c);
-                if(c < 'A' || c > 'Z')
+                auto letter = table[state][static_cast<unsigned char>(*c)];
+                if(letter >= Alphabet::first_state)
+                {
+                    // part way through a letter spelled with more than one byte
+                    state = letter - Alphabet::first_state;
+                    continue;
+                }
+                state = 0;
+
+                if(letter == Alphabet::skip)
+                    continue;
+
+                if(letter == Alphabet::reject)
                 {
                     skip_word = true;
                     break;
                 }
 
-                if(std::find(seen.begin(), seen.end(), c) != seen.end())
+                // no letter repeats, so a word can't be longer than the alphabet
+                auto bit = Letter_mask{1} << (letter - 'A');
+                if(seen & bit)
                 {
                     skip_word = true;
                     break;
                 }
-                seen.push_back(c);
+                seen |= bit;
+                word[length++] = letter;
             }
-            if(skip_word)
-                continue;
+            begin = line_end + 1;
 
-            const std::unordered_set<std::string> legal_small_words
-            {
-                "A", "I",
-                "AH", "AM", "AN", "AS", "AT", "BE", "BY", "DC", "DO",
-                "DR", "EX", "GO", "HA", "HE", "HI", "HO", "IF", "IN", "IS",
-                "IT", "LA", "LO", "MA", "ME", "MR", "MS", "MY", "NO", "OF",
-                "OH", "OK", "ON", "OR", "OW", "OX", "PA", "PI", "SO", "ST",
-                "TO", "UP", "US", "WE"
-            };
+            if(skip_word || state != 0 || !keep_length[length])
+                continue;
 
-            if(args.restrict_small_words && word.size() <= 2 && !legal_small_words.count(word))
+            if(restrict_small_words && length <= 2 && !std::binary_search(small_words.begin(), small_words.end(), std::string_view{word.data(), length}))
                 continue;
 
-            if(static_cast<int>(word.size()) == args.width)
-                row_words.insert(word);
-            if(static_cast<int>(word.size()) == args.height)
-                col_words.insert(word);
+            // there's only one empty word, so just note that it was seen
+            if(length == 0)
+                words[0].assign(1, '\0');
+            else
+                words[length].insert(words[length].end(), word.begin(), word.begin() + length);
         }
+    }
+
+private:
+    std::vector<Alphabet::Table> states;  // the alphabet's, plus skipping apostrophes if allowed
+    std::vector<std::string> small_words; // sorted, for binary_search
+    std::array<bool, ALPHABET_LEN + 1> keep_length{};
+    bool restrict_small_words;
+};
 
-        // put row words into a sorted list
-        std::vector<std::string>row_words_list(row_words.begin(), row_words.end());
-        std::sort(row_words_list.begin(), row_words_list.end());
+// the small words to keep with restrict_small_words, read with alphabet: the ones in args.small_words_filename,
+// one per line, or a built in list if not given. Returns nullopt after printing why if the file can't be used
+std::optional<std::vector<std::string>> get_small_words(const Args & args, const Alphabet & alphabet)
+{
+    std::vector<std::string> small_words;
+    if(args.small_words_filename.empty())
+    {
+        static constexpr std::array<std::string_view, 45> legal_small_words
+        {
+            "A", "AH", "AM", "AN", "AS", "AT", "BE", "BY", "DC", "DO",
+            "DR", "EX", "GO", "HA", "HE", "HI", "HO", "I", "IF", "IN",
+            "IS", "IT", "LA", "LO", "MA", "ME", "MR", "MS", "MY", "NO",
+            "OF", "OH", "OK", "ON", "OR", "OW", "OX", "PA", "PI", "SO",
+            "ST", "TO", "UP", "US", "WE"
+        };
 
-        // build list of 1,2,…,height -1, height col prefixes to check against
-        std::vector<std::unordered_set<std::string>> col_prefixes(args.height);
-        for(const auto & col: col_words)
+        // with another alphabet, only the words it can spell are kept
+        for(auto word: legal_small_words)
         {
-            for(std::size_t i = 0; i < static_cast<std::size_t>(args.height); ++i)
-                col_prefixes[i].insert(col.substr(0, i + 1));
+            if(auto normalized = alphabet.normalize(word))
+                small_words.push_back(std::move(*normalized));
         }
+        return std::make_optional(small_words);
+    }
 
-        return std::make_optional(std::make_tuple(row_words_list, col_prefixes));
+    std::ifstream file(args.small_words_filename);
+    if(!file)
+    {
+        std::cerr<<"Error opening "<<args.small_words_filename<<": "<<std::strerror(errno)<<std::endl;
+        return std::nullopt;
     }
-    catch(std::system_error & e)
+
+    std::string word;
+    while(file>>word)
     {
-        std::cerr<<"Error reading "<<args.dictionary_filename<<": "<<std::strerror(errno)<<std::endl;
+        auto normalized = alphabet.normalize(word);
+        if(!normalized || normalized->size() > 2)
+        {
+            std::cerr<<word<<" in "<<args.small_words_filename<<" isn't a word of 2 letters or less"<<std::endl;
+            return std::nullopt;
+        }
+        small_words.push_back(std::move(*normalized));
+    }
+    if(file.bad())
+    {
+        std::cerr<<"Error reading "<<args.small_words_filename<<": "<<std::strerror(errno)<<std::endl;
         return std::nullopt;
     }
-}
 
-std::mutex cout_mutex;
+    return std::make_optional(small_words);
+}
 
-void find_grids(const std::string & word,
-                const std::vector<std::string> & word_list,
-                const std::vector<std::unordered_set<std::string>> & col_prefixes,
-                const int height,
-                const std::vector<std::string> & cols,
-                const std::vector<std::string> & rows)
+// read and filter the dictionary, keeping only words of the given lengths. Regular files are mapped,
+// anything else is read in blocks. Either way, the text is split on line breaks between threads
+std::optional<Dictionary> get_word_lists(const Args & args, const Alphabet & alphabet, const std::vector<std::size_t> & lengths)
 {
-    // std::cout<<"thread: "<<std::this_thread::get_id()<<" "<<word<<"\n";
-    // check to see if adding this word would fit prefixes
-    auto match = true;
-    auto next_cols = cols;
-    for(std::size_t i = 0; i < word.size(); ++i)
+    auto small_words = get_small_words(args, alphabet);
+    if(!small_words)
+        return std::nullopt;
+
+    const Word_filter filter(args, alphabet, std::move(*small_words), lengths);
+
+    std::size_t num_threads = args.num_threads;
+    if(num_threads == 0)
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    // each thread's words. Each part of the text is added to these, so only the words kept stay in memory
+    std::vector<Word_filter::Words> thread_words(num_threads);
+
+    // filter [begin, end), which ends at the end of a line, splitting it between threads
+    auto parse = [&filter, &thread_words](const char * const begin, const char * const end)
     {
-        next_cols[i] += word[i];
+        // small parts aren't worth starting a thread for
+        constexpr std::size_t min_part_size = 1 << 20;
+        const auto size = static_cast<std::size_t>(end - begin);
+        const auto num_parts = std::clamp<std::size_t>(size / min_part_size, 1, thread_words.size());
 
-        if(!col_prefixes[next_cols[i].size() - 1].count(next_cols[i]))
+        // end each part after a line break, so no line is split
+        std::vector<const char *> bounds{begin};
+        for(std::size_t i = 1; i < num_parts; ++i)
         {
-            match = false;
-            break;
+            auto pos = std::max(begin + size * i / num_parts, bounds.back());
+            auto line_end = static_cast<const char *>(std::memchr(pos, '\n', end - pos));
+            bounds.push_back(line_end ? line_end + 1 : end);
         }
-    }
+        bounds.push_back(end);
 
-    if(!match)
-        return;
+        std::vector<std::thread> threads;
+        for(std::size_t i = 1; i < num_parts; ++i)
+            threads.emplace_back([&, i]{ filter.parse(bounds[i], bounds[i + 1], thread_words[i]); });
+
+        filter.parse(bounds[0], bounds[1], thread_words[0]);
+
+        for(auto & t: threads)
+            t.join();
+    };
 
-    // if this is the last row, print, continue
-    if(static_cast<int>(rows.size()) == height - 1)
+    auto fd = open(args.dictionary_filename.c_str(), O_RDONLY);
+    if(fd < 0)
     {
-        std::scoped_lock lock{cout_mutex};
+        std::cerr<<"Error opening "<<args.dictionary_filename<<": "<<std::strerror(errno)<<std::endl;
+        return std::nullopt;
+    }
 
-        for(const auto & row: rows)
-            std::cout<<row<<"\n";
-        std::cout<<word<<"\n"<<std::endl;
+    struct stat file_stat;
+    if(fstat(fd, &file_stat) < 0)
+    {
+        std::cerr<<"Error reading "<<args.dictionary_filename<<": "<<std::strerror(errno)<<std::endl;
+        close(fd);
+        return std::nullopt;
+    }
 
-        return;
+    auto data = S_ISREG(file_stat.st_mode) && file_stat.st_size > 0
+        ? mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    if(data != MAP_FAILED)
+    {
+        madvise(data, file_stat.st_size, MADV_SEQUENTIAL);
+        const auto * text = static_cast<const char *>(data);
+        parse(text, text + file_stat.st_size);
+        munmap(data, file_stat.st_size);
     }
+    else
+    {
+        // read a block at a time, keeping any partial line at the end for the next block
+        constexpr std::size_t block_size = 1 << 26;
+        std::vector<char> block(block_size);
+        std::size_t kept = 0;
+        while(true)
+        {
+            auto size = read(fd, block.data() + kept, block.size() - kept);
+            if(size < 0)
+            {
+                if(errno == EINTR)
+                    continue;
+                std::cerr<<"Error reading "<<args.dictionary_filename<<": "<<std::strerror(errno)<<std::endl;
+                close(fd);
+                return std::nullopt;
+            }
+
+            const auto * text = block.data();
+            const auto filled = kept + size;
+            if(size == 0)
+            {
+                parse(text, text + filled);
+                break;
+            }
 
-    // generate new list of words, removing any that share a letter with this one
-    auto next_word_list = word_list;
+            const char * last_line_end = nullptr;
+            for(auto i = filled; i > 0 && !last_line_end; --i)
+            {
+                if(text[i - 1] == '\n')
+                    last_line_end = text + i;
+            }
 
-    next_word_list.erase(std::remove_if(next_word_list.begin(), next_word_list.end(),
-                [&word](const std::string & try_word)
-                {return std::find_first_of(try_word.begin(), try_word.end(), word.begin(), word.end()) != try_word.end();}),
-            next_word_list.end());
+            if(!last_line_end)
+            {
+                // a line longer than a whole block can't be a word, so just skip past it
+                if(filled == block.size())
+                {
+                    kept = 0;
+                    block[kept++] = '!';
+                }
+                else
+                    kept = filled;
+                continue;
+            }
 
-    auto next_rows = rows;
-    next_rows.push_back(word);
+            parse(text, last_line_end);
+            kept = text + filled - last_line_end;
+            std::memmove(block.data(), last_line_end, kept);
+        }
+    }
+    close(fd);
 
-    // continue next row with newly reduced list
-    for(const auto & next_word: next_word_list)
+    // put each length's words into a sorted list, without repeats
+    Dictionary dict(args.use_apostrophe, args.restrict_small_words, alphabet);
+    for(auto length: lengths)
     {
-        find_grids(next_word, next_word_list, col_prefixes, height, next_cols, next_rows);
+        std::vector<std::string_view> words;
+        for(const auto & part: thread_words)
+        {
+            const auto & letters = part[length];
+            if(length == 0)
+            {
+                if(!letters.empty() && words.empty())
+                    words.emplace_back();
+                continue;
+            }
+            for(std::size_t i = 0; i < letters.size(); i += length)
+                words.emplace_back(&letters[i], length);
+        }
+        std::sort(words.begin(), words.end());
+        words.erase(std::unique(words.begin(), words.end()), words.end());
+
+        std::vector<char> sorted_letters;
+        sorted_letters.reserve(words.size() * length);
+        for(auto word: words)
+            sorted_letters.insert(sorted_letters.end(), word.begin(), word.end());
+
+        dict.set_words(length, std::move(sorted_letters), words.size());
+
+        for(auto & part: thread_words)
+            part[length] = {};
     }
+
+    return std::make_optional(std::move(dict));
 }
 
-int main(int argc, char ** argv)
+// count of heap allocations made by the current thread, so we can check that the search itself never allocates.
+// Counting replaces the global allocator, so it's only built in along with the other stats. The array forms
+// call these, so every form of new is counted
+thread_local std::size_t thread_allocations = 0;
+
+#ifndef WORD_GRID_NO_STATS
+// these are kept out of line, or GCC sees through them and warns that malloc and operator delete don't match
+[[gnu::noinline]] void * operator new(std::size_t size)
 {
-    auto args = parse_arguments(argc, argv);
-    if(!args)
-        return EXIT_FAILURE;
+    ++thread_allocations;
+    if(auto ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc{};
+}
 
-    auto words = get_word_lists(*args);
-    if(!words)
-        return EXIT_FAILURE;
+[[gnu::noinline]] void * operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    ++thread_allocations;
+    return std::malloc(size ? size : 1);
+}
+
+// for types with alignas, such as Search_stats
+[[gnu::noinline]] void * operator new(std::size_t size, std::align_val_t alignment)
+{
+    ++thread_allocations;
+    void * ptr = nullptr;
+    if(posix_memalign(&ptr, std::max(static_cast<std::size_t>(alignment), sizeof(void *)), size ? size : 1) == 0)
+        return ptr;
+    throw std::bad_alloc{};
+}
+
+[[gnu::noinline]] void * operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    ++thread_allocations;
+    void * ptr = nullptr;
+    if(posix_memalign(&ptr, std::max(static_cast<std::size_t>(alignment), sizeof(void *)), size ? size : 1) == 0)
+        return ptr;
+    return nullptr;
+}
+
+[[gnu::noinline]] void operator delete(void * ptr) noexcept
+{
+    std::free(ptr);
+}
+
+[[gnu::noinline]] void operator delete(void * ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+[[gnu::noinline]] void operator delete(void * ptr, std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
+
+[[gnu::noinline]] void operator delete(void * ptr, std::size_t, std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
+#endif
 
-    auto [row_words, col_prefixes] = *words;
+// counters are kept apart from anything another thread may write to, so counting doesn't cause false sharing
+constexpr std::size_t cache_line_size = 64;
 
-    const auto num_threads = std::thread::hardware_concurrency();
-    std::vector<std::thread> thread_pool;
-    auto chunk_size = row_words.size() / num_threads;
+// building with WORD_GRID_NO_STATS (cmake -DWORD_GRID_STATS=OFF) takes counting nodes, rejects, and lookups
+// out of the search. Grids are still counted, as the totals printed at the end come from them
+#ifdef WORD_GRID_NO_STATS
+constexpr bool count_stats = false;
+#else
+constexpr bool count_stats = true;
+#endif
 
-    // create num_threads threads, and divide row_words between them
-    // TODO: replace this with std::for_each(std::execution::par, …) once GCC / clang support it
-    for(std::size_t i = 0; i < num_threads; ++i)
+// a statistic that's only counted if count_stats is set, and stays 0 otherwise. It's the same size either way,
+// so checkpoints from either build can be resumed by the other
+struct Stat_counter
+{
+    std::size_t value = 0;
+
+    Stat_counter & operator++()
     {
-        thread_pool.emplace_back([chunk_size, &row_words, &col_prefixes, &args](const std::size_t i)
-        {
-            for(std::size_t j = chunk_size * i; j < chunk_size * (i + 1); ++j)
-            {
-                find_grids(row_words[j], row_words, col_prefixes, args->height,
-                    std::vector<std::string>(args->width), {});
-            }
-        }, i);
+        if constexpr(count_stats)
+            ++value;
+        return *this;
+    }
+
+    Stat_counter & operator+=(const std::size_t n)
+    {
+        if constexpr(count_stats)
+            value += n;
+        return *this;
     }
 
-    for(auto & t: thread_pool)
-        t.join();
+    operator std::size_t() const { return value; }
+};
+
+// work done at one row depth of the search
+struct Depth_stats
+{
+    Stat_counter nodes;              // words tried in this row
+    Stat_counter overlap_rejects;    // candidates dropped from this row for sharing a letter with the rows above
+    Stat_counter prefix_rejects;     // words tried that left a column that can't be continued
+    Stat_counter forward_rejects;    // words tried that left a column no remaining word can finish, or too few letters for the empty cells
+    std::size_t grids = 0;           // grids completed by this row
+
+    Depth_stats & operator+=(const Depth_stats & other)
+    {
+        nodes += other.nodes;
+        overlap_rejects += other.overlap_rejects;
+        prefix_rejects += other.prefix_rejects;
+        forward_rejects += other.forward_rejects;
+        grids += other.grids;
+        return *this;
+    }
+};
+
+struct alignas(cache_line_size) Search_stats
+{
+    std::array<Depth_stats, ALPHABET_LEN> depths{}; // indexed by row
+    Stat_counter prefix_lookups;                    // column trie lookups
+    std::size_t allocations = 0;                    // heap allocations made during the search
+
+    // calls to find_grids
+    std::size_t nodes() const
+    {
+        std::size_t total = 0;
+        for(const auto & depth: depths)
+            total += depth.nodes;
+        return total;
+    }
+
+    // grids found
+    std::size_t grids() const
+    {
+        std::size_t total = 0;
+        for(const auto & depth: depths)
+            total += depth.grids;
+        return total;
+    }
+
+    Search_stats & operator+=(const Search_stats & other)
+    {
+        for(std::size_t i = 0; i < depths.size(); ++i)
+            depths[i] += other.depths[i];
+        prefix_lookups += other.prefix_lookups;
+        allocations += other.allocations;
+        return *this;
+    }
+};
+
+// collects the output of all the search threads. Each thread appends to its
+// own Buffer, and hands it off only once it fills up. A single writer thread
+// writes those out, so the search threads never wait on I/O, and only
+// synchronize once per buffer
+class Output_writer
+{
+public:
+    static constexpr std::size_t buffer_size = 1 << 16;
+    static constexpr std::size_t max_pending = 64; // full buffers to queue before making threads wait for the writer
+
+    class Buffer
+    {
+    public:
+        explicit Buffer(Output_writer & writer):
+            writer{writer}
+        {
+            text.reserve(buffer_size);
+        }
+
+        Buffer(const Buffer &) = delete;
+        Buffer & operator=(const Buffer &) = delete;
+
+        ~Buffer() { flush(); }
+
+        void write(const char * data, const std::size_t size) { text.append(data, size); }
+        void put(const char c) { text.push_back(c); }
+
+        // call after each complete grid, so that a grid is never split between two buffers
+        void end_record()
+        {
+            if(text.size() >= buffer_size)
+                writer.submit(text);
+        }
+
+        void flush()
+        {
+            if(!text.empty())
+                writer.submit(text);
+        }
+
+    private:
+        Output_writer & writer;
+        std::string text;
+    };
+
+    // when use_thread is false, buffers are written by whichever thread submits them
+    Output_writer(std::FILE * file, const bool use_thread):
+        file{file}
+    {
+        if(use_thread)
+            writer_thread = std::thread{&Output_writer::write_loop, this};
+    }
+
+    Output_writer(const Output_writer &) = delete;
+    Output_writer & operator=(const Output_writer &) = delete;
+
+    ~Output_writer() { finish(); }
+
+    // write out everything submitted so far, and stop the writer thread
+    void finish()
+    {
+        if(writer_thread.joinable())
+        {
+            {
+                std::scoped_lock lock{mutex};
+                done = true;
+            }
+            ready.notify_one();
+            writer_thread.join();
+        }
+        std::fflush(file);
+    }
+
+    // wait until everything submitted so far has been written out
+    void sync()
+    {
+        if(writer_thread.joinable())
+        {
+            std::unique_lock lock{mutex};
+            space.wait(lock, [this]{ return full.empty() && !writing; });
+        }
+        std::fflush(file);
+    }
+
+private:
+    // queue text to be written, and replace it with an empty buffer
+    void submit(std::string & text)
+    {
+        if(!writer_thread.joinable())
+        {
+            std::fwrite(text.data(), 1, text.size(), file);
+            text.clear();
+            return;
+        }
+
+        std::unique_lock lock{mutex};
+        space.wait(lock, [this]{ return full.size() < max_pending; });
+
+        full.push_back(std::move(text));
+        if(!spare.empty())
+        {
+            text = std::move(spare.back());
+            spare.pop_back();
+        }
+        else
+        {
+            text = std::string{};
+            text.reserve(buffer_size);
+        }
+
+        lock.unlock();
+        ready.notify_one();
+    }
+
+    void write_loop()
+    {
+        std::vector<std::string> batch;
+        batch.reserve(max_pending);
+
+        std::unique_lock lock{mutex};
+        while(true)
+        {
+            ready.wait(lock, [this]{ return !full.empty() || done; });
+            if(full.empty())
+                break;
+
+            std::swap(batch, full);
+            writing = true;
+            lock.unlock();
+            space.notify_all();
+
+            for(auto & text: batch)
+                std::fwrite(text.data(), 1, text.size(), file);
+
+            lock.lock();
+            for(auto & text: batch)
+            {
+                text.clear();
+                spare.push_back(std::move(text));
+            }
+            batch.clear();
+            writing = false;
+            space.notify_all();
+        }
+    }
+
+    std::FILE * file;
+
+    std::mutex mutex;
+    std::condition_variable ready; // signals the writer that there are full buffers, or that we're done
+    std::condition_variable space; // signals search threads that the writer has taken the full buffers, and sync that it's written them
+    std::vector<std::string> full;
+    std::vector<std::string> spare;
+    bool writing = false;          // set while the writer thread is writing buffers it's taken from full
+    bool done = false;
+
+    std::thread writer_thread;
+};
+
+// keep the candidates whose letters don't overlap used: copies the matching entries of indexes and masks to
+// out_indexes and out_masks, and returns how many there were. The output arrays must have room for
+// count + filter_slack entries, since the vector versions write whole vectors past the last match
+using Filter_function = std::size_t (*)(const std::uint32_t * indexes, const Letter_mask * masks, std::size_t count,
+        Letter_mask used, std::uint32_t * out_indexes, Letter_mask * out_masks);
+
+constexpr std::size_t filter_slack = 16;
+
+std::size_t filter_scalar(const std::uint32_t * indexes, const Letter_mask * masks, const std::size_t count,
+        const Letter_mask used, std::uint32_t * out_indexes, Letter_mask * out_masks)
+{
+    std::size_t kept = 0;
+    for(std::size_t i = 0; i < count; ++i)
+    {
+        out_indexes[kept] = indexes[i];
+        out_masks[kept] = masks[i];
+        kept += (masks[i] & used) == 0;
+    }
+    return kept;
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && WORD_GRID_MAX_LETTERS <= 32
+static_assert(sizeof(Letter_mask) == sizeof(std::uint32_t), "these vector filters assume 32-bit letter masks");
+
+// for each 8-bit movemask, the lanes to gather so that the set lanes are packed at the front
+const auto avx2_compress_table = []
+{
+    std::array<std::array<std::uint32_t, 8>, 256> table{};
+    for(int bits = 0; bits < 256; ++bits)
+    {
+        int lane = 0;
+        for(int i = 0; i < 8; ++i)
+        {
+            if(bits & (1 << i))
+                table[bits][lane++] = i;
+        }
+    }
+    return table;
+}();
+
+__attribute__((target("avx2")))
+std::size_t filter_avx2(const std::uint32_t * indexes, const Letter_mask * masks, const std::size_t count,
+        const Letter_mask used, std::uint32_t * out_indexes, Letter_mask * out_masks)
+{
+    const auto used_v = _mm256_set1_epi32(static_cast<int>(used));
+    const auto zero = _mm256_setzero_si256();
+
+    std::size_t kept = 0;
+    std::size_t i = 0;
+    for(; i + 8 <= count; i += 8)
+    {
+        auto masks_v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(masks + i));
+        auto indexes_v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(indexes + i));
+
+        auto keep = _mm256_cmpeq_epi32(_mm256_and_si256(masks_v, used_v), zero);
+        auto bits = _mm256_movemask_ps(_mm256_castsi256_ps(keep));
+        auto perm = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(avx2_compress_table[bits].data()));
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out_indexes + kept), _mm256_permutevar8x32_epi32(indexes_v, perm));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out_masks + kept), _mm256_permutevar8x32_epi32(masks_v, perm));
+        kept += __builtin_popcount(bits);
+    }
+
+    return kept + filter_scalar(indexes + i, masks + i, count - i, used, out_indexes + kept, out_masks + kept);
+}
+
+__attribute__((target("avx512f")))
+std::size_t filter_avx512(const std::uint32_t * indexes, const Letter_mask * masks, const std::size_t count,
+        const Letter_mask used, std::uint32_t * out_indexes, Letter_mask * out_masks)
+{
+    const auto used_v = _mm512_set1_epi32(static_cast<int>(used));
+
+    std::size_t kept = 0;
+    std::size_t i = 0;
+    for(; i + 16 <= count; i += 16)
+    {
+        auto masks_v = _mm512_loadu_si512(masks + i);
+        auto indexes_v = _mm512_loadu_si512(indexes + i);
+
+        auto keep = _mm512_testn_epi32_mask(masks_v, used_v);
+
+        _mm512_storeu_si512(out_indexes + kept, _mm512_maskz_compress_epi32(keep, indexes_v));
+        _mm512_storeu_si512(out_masks + kept, _mm512_maskz_compress_epi32(keep, masks_v));
+        kept += __builtin_popcount(keep);
+    }
+
+    return kept + filter_scalar(indexes + i, masks + i, count - i, used, out_indexes + kept, out_masks + kept);
+}
+#elif defined(__x86_64__) || defined(__i386__)
+static_assert(sizeof(Letter_mask) == sizeof(std::uint64_t), "these vector filters assume 64-bit letter masks");
+
+// for each 4-bit movemask, the 32-bit lanes to gather so that the set 64-bit lanes are packed at the front:
+// [0] for the indexes, [1] for the masks, which take two lanes each
+const auto avx2_compress_table = []
+{
+    std::array<std::array<std::array<std::uint32_t, 8>, 2>, 16> table{};
+    for(int bits = 0; bits < 16; ++bits)
+    {
+        int lane = 0;
+        for(int i = 0; i < 4; ++i)
+        {
+            if(bits & (1 << i))
+            {
+                table[bits][0][lane] = i;
+                table[bits][1][2 * lane] = 2 * i;
+                table[bits][1][2 * lane + 1] = 2 * i + 1;
+                ++lane;
+            }
+        }
+    }
+    return table;
+}();
+
+__attribute__((target("avx2")))
+std::size_t filter_avx2(const std::uint32_t * indexes, const Letter_mask * masks, const std::size_t count,
+        const Letter_mask used, std::uint32_t * out_indexes, Letter_mask * out_masks)
+{
+    const auto used_v = _mm256_set1_epi64x(static_cast<long long>(used));
+    const auto zero = _mm256_setzero_si256();
+
+    std::size_t kept = 0;
+    std::size_t i = 0;
+    for(; i + 4 <= count; i += 4)
+    {
+        auto masks_v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(masks + i));
+        auto indexes_v = _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(indexes + i)));
+
+        auto keep = _mm256_cmpeq_epi64(_mm256_and_si256(masks_v, used_v), zero);
+        auto bits = _mm256_movemask_pd(_mm256_castsi256_pd(keep));
+        const auto & perms = avx2_compress_table[bits];
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out_indexes + kept),
+                _mm256_permutevar8x32_epi32(indexes_v, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(perms[0].data()))));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out_masks + kept),
+                _mm256_permutevar8x32_epi32(masks_v, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(perms[1].data()))));
+        kept += __builtin_popcount(bits);
+    }
+
+    return kept + filter_scalar(indexes + i, masks + i, count - i, used, out_indexes + kept, out_masks + kept);
+}
+
+__attribute__((target("avx512f")))
+std::size_t filter_avx512(const std::uint32_t * indexes, const Letter_mask * masks, const std::size_t count,
+        const Letter_mask used, std::uint32_t * out_indexes, Letter_mask * out_masks)
+{
+    const auto used_v = _mm512_set1_epi64(static_cast<long long>(used));
+
+    std::size_t kept = 0;
+    std::size_t i = 0;
+    for(; i + 8 <= count; i += 8)
+    {
+        auto masks_v = _mm512_loadu_si512(masks + i);
+        auto indexes_v = _mm512_castsi256_si512(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(indexes + i)));
+
+        auto keep = _mm512_testn_epi64_mask(masks_v, used_v);
+
+        _mm512_storeu_si512(out_indexes + kept, _mm512_maskz_compress_epi32(keep, indexes_v));
+        _mm512_storeu_si512(out_masks + kept, _mm512_maskz_compress_epi64(keep, masks_v));
+        kept += __builtin_popcount(keep);
+    }
+
+    return kept + filter_scalar(indexes + i, masks + i, count - i, used, out_indexes + kept, out_masks + kept);
+}
+#endif
+
+// pick a filter by name ("avx512", "avx2", "scalar"), or the fastest this CPU supports if name is "auto".
+// Returns nullptr if the named filter isn't available
+Filter_function get_filter(const std::string & name)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if((name == "auto" || name == "avx512") && __builtin_cpu_supports("avx512f"))
+        return filter_avx512;
+    if((name == "auto" || name == "avx2") && __builtin_cpu_supports("avx2"))
+        return filter_avx2;
+#endif
+    if(name == "auto" || name == "scalar")
+        return filter_scalar;
+    return nullptr;
+}
+
+// solves the last two rows of many grids at once, which the rows search hands off in batches.
+// Each is small and the same shape, which suits a device that runs thousands of them side by side
+class Bottom_rows_solver
+{
+public:
+    virtual ~Bottom_rows_solver() = default;
+
+    // append every pair of candidates that finishes each subproblem to solutions, in order of subproblem.
+    // Can be called from several threads at once
+    virtual void solve(const std::vector<offload::Subproblem> & subproblems, const std::vector<std::uint32_t> & candidates,
+            std::vector<offload::Solution> & solutions) = 0;
+};
+
+static_assert(sizeof(offload::Trie_node) == sizeof(Prefix_trie::Node) && offload::alphabet_len == ALPHABET_LEN
+        && std::is_same_v<offload::Letter_mask, Letter_mask>);
+
+// solves batches on the calling thread, the same way the CUDA kernel does. For checking the
+// batching against the rows search without a device, and for when the device fails
+class Cpu_bottom_rows final: public Bottom_rows_solver
+{
+public:
+    Cpu_bottom_rows(const Word_list & row_words, const Prefix_trie & col_prefixes): row_words{row_words}, col_prefixes{col_prefixes} {}
+
+    void solve(const std::vector<offload::Subproblem> & subproblems, const std::vector<std::uint32_t> & candidates,
+            std::vector<offload::Solution> & solutions) override
+    {
+        const auto width = row_words.length;
+        for(std::uint32_t s = 0; s < subproblems.size(); ++s)
+        {
+            const auto & subproblem = subproblems[s];
+            const auto begin = candidates.begin() + subproblem.first_candidate, end = begin + subproblem.num_candidates;
+            for(auto upper = begin; upper != end; ++upper)
+            {
+                // put the candidate in the next to last row, if every column can continue with its letter
+                std::array<Prefix_trie::Node_id, ALPHABET_LEN> below;
+                const auto * upper_word = row_words.word(*upper);
+                std::size_t c = 0;
+                for(; c < width; ++c)
+                {
+                    below[c] = col_prefixes.next(subproblem.cols[c], upper_word[c]);
+                    if(below[c] == Prefix_trie::none)
+                        break;
+                }
+                if(c < width)
+                    continue;
+
+                // and every candidate that shares no letter with it, and finishes every column, in the last row
+                for(auto lower = begin; lower != end; ++lower)
+                {
+                    if(row_words.masks[*lower] & row_words.masks[*upper])
+                        continue;
+
+                    const auto * lower_word = row_words.word(*lower);
+                    for(c = 0; c < width && col_prefixes.next(below[c], lower_word[c]) != Prefix_trie::none; ++c)
+                        ;
+                    if(c == width)
+                        solutions.push_back({s, {*upper, *lower}});
+                }
+            }
+        }
+    }
+
+private:
+    const Word_list & row_words;
+    const Prefix_trie & col_prefixes;
+};
+
+#ifdef WORD_GRID_CUDA
+// solves batches on a CUDA device. If the device fails partway, says so, and carries on on the CPU
+class Cuda_bottom_rows final: public Bottom_rows_solver
+{
+public:
+    Cuda_bottom_rows(std::unique_ptr<offload::Cuda_device> device, const Word_list & row_words, const Prefix_trie & col_prefixes):
+        device{std::move(device)},
+        fallback{row_words, col_prefixes}
+    {}
+
+    void solve(const std::vector<offload::Subproblem> & subproblems, const std::vector<std::uint32_t> & candidates,
+            std::vector<offload::Solution> & solutions) override
+    {
+        if(!failed.load(std::memory_order_relaxed))
+        {
+            const auto size = solutions.size();
+            if(device->solve(subproblems, candidates, solutions))
+                return;
+
+            solutions.resize(size);
+            if(!failed.exchange(true))
+                std::cerr<<"Solving the rest on the CPU\n";
+        }
+        fallback.solve(subproblems, candidates, solutions);
+    }
+
+private:
+    std::unique_ptr<offload::Cuda_device> device;
+    Cpu_bottom_rows fallback;
+    std::atomic<bool> failed{false};
+};
+#endif
+
+// create the solver called name for a job with these words, or return nullptr after printing why it couldn't be
+std::unique_ptr<Bottom_rows_solver> make_bottom_rows_solver(const std::string & name, const Word_list & row_words, const Prefix_trie & col_prefixes)
+{
+#ifdef WORD_GRID_CUDA
+    if(name == "cuda")
+    {
+        auto device = offload::Cuda_device::create(reinterpret_cast<const offload::Trie_node *>(col_prefixes.nodes.data), col_prefixes.nodes.size,
+                row_words.letters.data, row_words.masks.data, row_words.size(), row_words.length);
+        if(!device)
+            return nullptr;
+        return std::make_unique<Cuda_bottom_rows>(std::move(device), row_words, col_prefixes);
+    }
+#endif
+    if(name == "cpu")
+        return std::make_unique<Cpu_bottom_rows>(row_words, col_prefixes);
+
+    std::cerr<<"word_grid was built without support for --offload "<<name<<"\n";
+    return nullptr;
+}
+
+// ways to search for grids
+enum class Engine
+{
+    rows,     // fill rows top to bottom
+    adaptive, // fill the next row or the next column, whichever has fewer choices
+    dlx,      // solve it as an exact cover problem, with dancing links
+};
+
+// the engine called name: rows, adaptive, or dlx
+Engine get_engine(const std::string & name)
+{
+    return name == "adaptive" ? Engine::adaptive : name == "dlx" ? Engine::dlx : Engine::rows;
+}
+
+// how grids are output
+enum class Output_format
+{
+    text,   // each row on its own line, with a blank line after each grid
+    binary, // a header describing the sizes, then each grid as its rows' word indexes. See write_binary_header
+    jsonl,  // a JSON object per line
+};
+
+// one grid size to search for, along with the word lists it uses
+struct Search_job
+{
+    int width = 0;
+    int height = 0;
+    const Word_list * row_words = nullptr;
+    const Prefix_trie * col_prefixes = nullptr;
+    bool canonical = false;                    // for square grids, find only one of each grid / transpose pair
+    bool count_only = false;                   // count grids without outputting them
+    std::uint64_t limit = 0;                   // stop after finding this many grids, if not 0
+    Filter_function filter = filter_scalar;
+    std::vector<std::uint32_t> top_words;      // indexes into row_words of the top rows to search, in order
+    Engine engine = Engine::rows;
+    Output_writer * record = nullptr;          // also write every grid found here as a Solution_file record, if set
+    Output_format format = Output_format::text;
+    std::optional<std::uint64_t> random_seed;  // if set, search in a random order from this seed. See randomize_job
+    bool rare_first = false;                   // below the top row, try words with rarer letters first. See get_rarity
+    Bottom_rows_solver * offload = nullptr;    // for the rows engine, solve the last two rows in batches here, if set
+    const Alphabet * alphabet = nullptr;       // how to spell letters in text and JSON, if not as they're stored
+    int size_index = -1;                       // which of the run's sizes this is, to tag binary output with, or -1 if there's only one
+};
+
+// shared by all threads searching the same job
+struct Job_progress
+{
+    std::atomic<std::uint64_t> found{0}; // only kept up to date when the job has a limit
+    std::atomic<bool> stop{false};       // set once all the grids we need have been found
+    std::atomic<std::chrono::steady_clock::rep> first_grid{0}; // when the first grid was found, if the job has a limit
+};
+
+// shuffle the job's top words with seed, and have its searches pick candidates in a random order too.
+// The rows engine then leaves each top row after its first grid, so the grids found are spread out
+void randomize_job(Search_job & job, const std::uint64_t seed)
+{
+    std::shuffle(job.top_words.begin(), job.top_words.end(), std::mt19937_64{seed});
+    job.random_seed = seed;
+}
+
+// for each word, how many words have its rarest letter. Words with a low count have a letter
+// few others can supply, so trying them first makes grids that need that letter turn up sooner
+std::vector<std::uint32_t> get_rarity(const Word_list & words)
+{
+    std::array<std::uint32_t, ALPHABET_LEN> letter_counts{};
+    for(std::size_t i = 0; i < words.size(); ++i)
+    {
+        for(auto letters = words.masks[i]; letters != 0; letters &= letters - 1)
+            ++letter_counts[lowest_letter(letters)];
+    }
+
+    std::vector<std::uint32_t> rarity(words.size(), std::numeric_limits<std::uint32_t>::max());
+    for(std::size_t i = 0; i < words.size(); ++i)
+    {
+        for(auto letters = words.masks[i]; letters != 0; letters &= letters - 1)
+            rarity[i] = std::min(rarity[i], letter_counts[lowest_letter(letters)]);
+    }
+    return rarity;
+}
+
+// order word indexes so the words with rarer letters come first, keeping the order of equally rare ones
+void sort_rare_first(const Word_list & words, std::vector<std::uint32_t> & indexes)
+{
+    const auto rarity = get_rarity(words);
+    std::stable_sort(indexes.begin(), indexes.end(), [&rarity](const std::uint32_t a, const std::uint32_t b) { return rarity[a] < rarity[b]; });
+}
+
+// append n in decimal, without allocating
+inline void put_number(Output_writer::Buffer & output, std::uint64_t n)
+{
+    std::array<char, 20> digits;
+    auto end = digits.end(), pos = end;
+    do
+    {
+        *--pos = static_cast<char>('0' + n % 10);
+        n /= 10;
+    } while(n != 0);
+    output.write(pos, end - pos);
+}
+
+// append n as a little-endian base 128 varint: 7 bits per byte, with the high bit set on all but the last
+inline void put_varint(Output_writer::Buffer & output, std::uint64_t n)
+{
+    while(n >= 0x80)
+    {
+        output.put(static_cast<char>(n | 0x80));
+        n >>= 7;
+    }
+    output.put(static_cast<char>(n));
+}
+
+// append n as size little-endian bytes
+inline void put_little_endian(Output_writer::Buffer & output, std::uint64_t n, const std::size_t size)
+{
+    for(std::size_t i = 0; i < size; ++i, n >>= 8)
+        output.put(static_cast<char>(n));
+}
+
+// append length stored letters, spelled in job's alphabet
+inline void put_letters(Output_writer::Buffer & output, const Search_job & job, const char * letters, const std::size_t length)
+{
+    if(!job.alphabet)
+    {
+        output.write(letters, length);
+        return;
+    }
+    for(std::size_t i = 0; i < length; ++i)
+    {
+        const auto & spelling = job.alphabet->spelling(letters[i] - 'A');
+        output.write(spelling.data(), spelling.size());
+    }
+}
+
+// output a grid in job.format, given its rows' indexes into job.row_words
+void write_grid(Output_writer::Buffer & output, const Search_job & job, const std::uint32_t * rows)
+{
+    switch(job.format)
+    {
+        case Output_format::text:
+            for(int row = 0; row < job.height; ++row)
+            {
+                put_letters(output, job, job.row_words->word(rows[row]), job.width);
+                output.put('\n');
+            }
+            output.put('\n');
+            break;
+
+        case Output_format::binary:
+            if(job.size_index >= 0)
+                put_varint(output, job.size_index);
+            for(int row = 0; row < job.height; ++row)
+                put_varint(output, rows[row]);
+            break;
+
+        case Output_format::jsonl:
+        {
+            constexpr std::string_view width = "{\"width\":", height = ",\"height\":", rows_start = ",\"rows\":[\"";
+            output.write(width.data(), width.size());
+            put_number(output, job.width);
+            output.write(height.data(), height.size());
+            put_number(output, job.height);
+            output.write(rows_start.data(), rows_start.size());
+            for(int row = 0; row < job.height; ++row)
+            {
+                if(row > 0)
+                    output.write("\",\"", 3);
+                put_letters(output, job, job.row_words->word(rows[row]), job.width);
+            }
+            output.write("\"]}\n", 4);
+            break;
+        }
+    }
+    output.end_record();
+}
+
+// binary output starts with this, all little-endian:
+//   8 bytes   "WGRIDBIN"
+//   4 bytes   version (1)
+//   4 bytes   flags: 1 if apostrophes were removed (no -n), 2 if small words were restricted (no -s), 4 for --canonical
+//   4 bytes   number of sizes
+// then for each size:
+//   4 bytes   width
+//   4 bytes   height
+//   4 bytes   number of words in the row word list
+//   8 bytes   FNV-1a hash of the row word list, the words in sorted order packed together, to check a decoder's copy against
+// Each grid is then its rows' varint indexes into its size's row word list, which is the dictionary's words of that
+// length in sorted order, as listed by --build-index. If there's more than one size, each grid starts with a
+// varint of which size it is, counting from 0
+void write_binary_header(Output_writer::Buffer & output, const std::vector<Search_job> & jobs, const bool use_apostrophe,
+        const bool restrict_small_words, const bool canonical)
+{
+    output.write("WGRIDBIN", 8);
+    put_little_endian(output, 1, 4);
+    put_little_endian(output, (use_apostrophe ? 1 : 0) | (restrict_small_words ? 2 : 0) | (canonical ? 4 : 0), 4);
+    put_little_endian(output, jobs.size(), 4);
+    for(const auto & job: jobs)
+    {
+        put_little_endian(output, job.width, 4);
+        put_little_endian(output, job.height, 4);
+        put_little_endian(output, job.row_words->size(), 4);
+        put_little_endian(output, hash_bytes(job.row_words->letters.data, job.row_words->letters.size), 8);
+    }
+    output.end_record();
+}
+
+// on-disk cache of every grid of one size, for a given word list and options, so a search only has to be
+// done once. Each grid is stored as its rows' indexes into the row word list, in as few bytes as the list
+// needs, least significant first. Like the index, the header is in native byte order
+class Solution_file
+{
+public:
+    // identifies a search's results
+    struct Key
+    {
+        std::uint32_t width = 0;
+        std::uint32_t height = 0;
+        std::uint32_t flags = 0;
+        std::uint32_t index_bytes = 0;  // bytes per row word index
+        std::uint64_t num_words = 0;    // in the row word list
+        std::uint64_t words_hash = 0;   // of the row and column word lists
+    };
+
+    static Key make_key(const Word_list & row_words, const Word_list & col_words, const bool use_apostrophe,
+            const bool restrict_small_words, const bool canonical)
+    {
+        Key key;
+        key.width = row_words.length;
+        key.height = col_words.length;
+        key.flags = (use_apostrophe ? solution_apostrophe : 0) | (restrict_small_words ? solution_small_words : 0)
+            | (canonical && key.width == key.height && key.width > 1 ? solution_canonical : 0);
+        key.index_bytes = get_index_bytes(row_words.size());
+        key.num_words = row_words.size();
+        key.words_hash = hash_bytes(col_words.letters.data, col_words.letters.size,
+                hash_bytes(row_words.letters.data, row_words.letters.size));
+        return key;
+    }
+
+    // where the results for key are kept in directory
+    static std::string get_filename(const std::string & directory, const Key & key)
+    {
+        auto key_hash = hash_bytes(&key, sizeof(key));
+        std::ostringstream filename;
+        filename<<directory<<"/"<<key.width<<"x"<<key.height<<"-"<<std::hex<<std::setw(16)<<std::setfill('0')<<key_hash<<".grids";
+        return filename.str();
+    }
+
+    // bytes needed to store an index into a list of num_words words
+    static std::uint32_t get_index_bytes(const std::size_t num_words)
+    {
+        std::uint32_t bytes = 1;
+        while(bytes < 4 && num_words > (std::size_t{1} << (8 * bytes)))
+            ++bytes;
+        return bytes;
+    }
+
+    // append a grid, given each of its rows' word indexes
+    static void write_record(Output_writer::Buffer & record, const std::uint32_t * rows, const int height, const std::uint32_t index_bytes)
+    {
+        for(int row = 0; row < height; ++row)
+        {
+            for(std::uint32_t i = 0; i < index_bytes; ++i)
+                record.put(static_cast<char>(rows[row] >> (8 * i)));
+        }
+        record.end_record();
+    }
+
+    // output up to job.limit (or all, if 0) of the grids cached for key, unless job.count_only is set. Returns the number
+    // of grids, or nullopt if they aren't cached. The whole file is checked before anything is output, and if it's
+    // unusable, that's reported and it's treated as not cached
+    static std::optional<std::uint64_t> read(const std::string & filename, const Key & key, const Search_job & job, Output_writer::Buffer & output)
+    {
+        auto fd = open(filename.c_str(), O_RDONLY);
+        if(fd < 0)
+        {
+            if(errno != ENOENT)
+                std::cerr<<"Error opening "<<filename<<": "<<std::strerror(errno)<<std::endl;
+            return std::nullopt;
+        }
+
+        struct stat file_stat;
+        if(fstat(fd, &file_stat) < 0)
+        {
+            std::cerr<<"Error reading "<<filename<<": "<<std::strerror(errno)<<std::endl;
+            close(fd);
+            return std::nullopt;
+        }
+
+        const auto size = static_cast<std::size_t>(file_stat.st_size);
+        auto data = size >= sizeof(Header) ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        close(fd);
+        if(data == MAP_FAILED)
+        {
+            std::cerr<<filename<<" is not a word_grid solution cache. Searching again"<<std::endl;
+            return std::nullopt;
+        }
+        madvise(data, size, MADV_SEQUENTIAL);
+
+        const auto & header = *static_cast<const Header *>(data);
+        const std::size_t grid_bytes = key.height * key.index_bytes;
+        const auto * grids = static_cast<const unsigned char *>(data) + sizeof(Header);
+
+        auto ok = std::equal(std::begin(solution_magic), std::end(solution_magic), header.magic.begin())
+            && header.byte_order == solution_byte_order && header.version == solution_version
+            && std::memcmp(&header.key, &key, sizeof(key)) == 0
+            && header.num_grids == (size - sizeof(Header)) / grid_bytes && (size - sizeof(Header)) % grid_bytes == 0;
+
+        auto get_index = [&key, grids](const std::size_t i)
+        {
+            std::uint32_t index = 0;
+            for(std::uint32_t b = 0; b < key.index_bytes; ++b)
+                index |= std::uint32_t{grids[i * key.index_bytes + b]} << (8 * b);
+            return index;
+        };
+
+        const auto num_grids = ok ? (job.limit != 0 ? std::min(job.limit, header.num_grids) : header.num_grids) : 0;
+        for(std::size_t i = 0; ok && i < num_grids * key.height; ++i)
+            ok = get_index(i) < job.row_words->size();
+
+        if(!ok)
+        {
+            std::cerr<<filename<<" is not a cache of this search, or is corrupt or from a different version or machine. Searching again"<<std::endl;
+            munmap(data, size);
+            return std::nullopt;
+        }
+
+        if(!job.count_only)
+        {
+            std::array<std::uint32_t, ALPHABET_LEN> rows;
+            for(std::size_t grid = 0; grid < num_grids; ++grid)
+            {
+                for(std::uint32_t row = 0; row < key.height; ++row)
+                    rows[row] = get_index(grid * key.height + row);
+                write_grid(output, job, rows.data());
+            }
+        }
+
+        munmap(data, size);
+        return num_grids;
+    }
+
+    // records the grids found by a search, through an Output_writer that searches write records to
+    class Recorder
+    {
+    public:
+        Recorder(const std::string & filename, const Key & key):
+            filename{filename},
+            tmp_filename{filename + ".tmp"},
+            key{key},
+            file{std::fopen(tmp_filename.c_str(), "wb")}
+        {
+            if(!file)
+            {
+                std::cerr<<"Error opening "<<tmp_filename<<": "<<std::strerror(errno)<<". Results won't be cached"<<std::endl;
+                return;
+            }
+
+            // the grid count is filled in once the search is done
+            auto header = make_header(key, 0);
+            if(std::fwrite(&header, sizeof(header), 1, file) != 1)
+            {
+                std::cerr<<"Error writing "<<tmp_filename<<": "<<std::strerror(errno)<<". Results won't be cached"<<std::endl;
+                std::fclose(file);
+                std::remove(tmp_filename.c_str());
+                file = nullptr;
+                return;
+            }
+
+            writer.emplace(file, false);
+        }
+
+        Recorder(const Recorder &) = delete;
+        Recorder & operator=(const Recorder &) = delete;
+
+        // if the search wasn't finished, don't leave anything behind
+        ~Recorder()
+        {
+            if(file)
+            {
+                writer.reset();
+                std::fclose(file);
+                std::remove(tmp_filename.c_str());
+            }
+        }
+
+        // where searches should write records, or nullptr if the file couldn't be created
+        Output_writer * get_writer() { return writer ? &*writer : nullptr; }
+
+        // call once the search has found every grid, and every search writing to this has been destroyed
+        bool finish(const std::uint64_t num_grids)
+        {
+            if(!file)
+                return false;
+
+            writer.reset();
+
+            auto header = make_header(key, num_grids);
+
+            auto ok = std::ferror(file) == 0 && std::fseek(file, 0, SEEK_SET) == 0
+                && std::fwrite(&header, sizeof(header), 1, file) == 1
+                && std::fflush(file) == 0 && fsync(fileno(file)) == 0;
+            if(std::fclose(file) != 0)
+                ok = false;
+            file = nullptr;
+
+            if(!ok || std::rename(tmp_filename.c_str(), filename.c_str()) != 0)
+            {
+                std::cerr<<"Error writing "<<filename<<": "<<std::strerror(errno)<<std::endl;
+                std::remove(tmp_filename.c_str());
+                return false;
+            }
+            return true;
+        }
+
+    private:
+        const std::string filename;
+        const std::string tmp_filename;
+        const Key key;
+        std::FILE * file;
+        std::optional<Output_writer> writer;
+    };
+
+private:
+    static constexpr char solution_magic[8] = {'W', 'G', 'R', 'I', 'D', 'S', 'O', 'L'};
+    static constexpr std::uint32_t solution_byte_order = 0x01020304;
+    static constexpr std::uint32_t solution_version = 1;
+
+    static constexpr std::uint32_t solution_apostrophe = 1 << 0;
+    static constexpr std::uint32_t solution_small_words = 1 << 1;
+    static constexpr std::uint32_t solution_canonical = 1 << 2;
+
+    struct Header
+    {
+        std::array<char, sizeof(solution_magic)> magic{};
+        std::uint32_t byte_order = solution_byte_order;
+        std::uint32_t version = solution_version;
+        Key key;
+        std::uint64_t num_grids = 0;
+    };
+
+    static Header make_header(const Key & key, const std::uint64_t num_grids)
+    {
+        Header header;
+        std::copy(std::begin(solution_magic), std::end(solution_magic), header.magic.begin());
+        header.key = key;
+        header.num_grids = num_grids;
+        return header;
+    }
+};
+
+// interface the work queue drives a single thread's search through, so that
+// each job can use a search specialized for its grid size
+class Search_engine
+{
+public:
+    virtual ~Search_engine() = default;
+
+    // place row_words[first_word] as the top row, and find the words that may go below it.
+    // Returns the number of those words, which search_second_row can then be called with
+    virtual std::size_t set_top_row(std::uint32_t first_word) = 0;
+
+    // find all grids with the current top row, and the index'th word that may go below it
+    virtual void search_second_row(std::size_t index) = 0;
+
+    virtual std::optional<std::uint32_t> get_top_row() const = 0;
+    virtual const Search_stats & get_stats() const = 0;
+};
+
+// search state for a single thread. Everything find_grids needs for each
+// row depth is allocated up front, so descending a level never touches the heap.
+//
+// The candidates for each row are kept in sorted order, so they're grouped by
+// first letter. Only the groups for letters the first column's trie node can
+// continue with are ever looked at.
+//
+// W and H are the grid size, or 0 if only known at run time. With them fixed,
+// the per-row state is fixed size arrays, and the column loops unroll
+template <int W, int H>
+class Grid_search final: public Search_engine
+{
+public:
+    Grid_search(const Search_job & job, Job_progress & progress, Output_writer::Buffer & output):
+        job{job},
+        row_words{*job.row_words},
+        col_prefixes{*job.col_prefixes},
+        runtime_width{job.width},
+        runtime_height{job.height},
+        canonical{job.canonical && job.width == job.height && job.width > 1},
+        count_only{job.count_only},
+        limit{job.limit},
+        progress{progress},
+        output{output},
+        filter{job.filter},
+        candidates(job.height, std::vector<std::uint32_t>(row_words.size() + filter_slack)),
+        candidate_masks(job.height, std::vector<Letter_mask>(row_words.size() + filter_slack)),
+        second_rows(row_words.size()),
+        record_index_bytes{Solution_file::get_index_bytes(row_words.size())},
+        randomize{job.random_seed.has_value()},
+        seed{job.random_seed.value_or(0)},
+        offload{job.offload}
+    {
+        if(job.record)
+            record.emplace(*job.record);
+
+        // a batch is handed off once it's this big, so a grid's worth past it has to fit too
+        if(offload)
+        {
+            subproblems.reserve(offload_batch_size);
+            subproblem_candidates.reserve(offload_batch_size + row_words.size());
+            subproblem_rows.reserve((offload_batch_size + 1) * job.height);
+        }
+
+        cols.fill(Prefix_trie::root);
+
+        // any word can go in the top row
+        std::iota(candidates[0].begin(), candidates[0].end(), 0);
+        if(job.rare_first)
+        {
+            // reorder each first letter's group, which filtering keeps for every row below
+            const auto rarity = get_rarity(row_words);
+            std::stable_sort(candidates[0].begin(), candidates[0].begin() + row_words.size(), [this, &rarity](const std::uint32_t a, const std::uint32_t b)
+            {
+                return std::make_pair(row_words.word(a)[0], rarity[a]) < std::make_pair(row_words.word(b)[0], rarity[b]);
+            });
+        }
+        for(std::size_t i = 0; i < row_words.size(); ++i)
+            candidate_masks[0][i] = row_words.masks[candidates[0][i]];
+        for(int letter = 0, i = 0; letter <= ALPHABET_LEN; ++letter)
+        {
+            while(i < static_cast<int>(row_words.size()) && row_words.word(i)[0] - 'A' < letter)
+                ++i;
+            letter_starts[0][letter] = i;
+        }
+        first_letters[0] = col_prefixes.nodes[Prefix_trie::root].letters;
+    }
+
+    std::size_t set_top_row(const std::uint32_t first_word) override
+    {
+        auto allocations = thread_allocations;
+
+        // seeded from the top word, so every thread working on it lists its second rows in the same order
+        if(randomize)
+            rng.seed(seed ^ (first_word * 0x9e3779b97f4a7c15));
+
+        num_second_rows = 0;
+        if(place_row(0, first_word))
+        {
+            for_each_candidate(1, [this](const std::uint32_t word_index)
+            {
+                second_rows[num_second_rows++] = word_index;
+                return true;
+            });
+        }
+        if(randomize)
+            std::shuffle(second_rows.begin(), second_rows.begin() + num_second_rows, rng);
+
+        stats.allocations += thread_allocations - allocations;
+
+        top_row = first_word;
+        return num_second_rows;
+    }
+
+    void search_second_row(const std::size_t index) override
+    {
+        // the order below depends only on the seed and the rows above, not on which thread searches it
+        if(randomize)
+            rng.seed(seed ^ (*top_row * 0x9e3779b97f4a7c15) ^ (index * 0xc2b2ae3d27d4eb4f));
+        branch_done = false;
+
+        auto allocations = thread_allocations;
+        find_grids(1, second_rows[index]);
+
+        // finish everything below this second row before saying it's done
+        if(offload)
+            solve_subproblems();
+        stats.allocations += thread_allocations - allocations;
+    }
+
+    std::optional<std::uint32_t> get_top_row() const override { return top_row; }
+    const Search_stats & get_stats() const override { return stats; }
+
+private:
+    static constexpr int max_width = W > 0 ? W : ALPHABET_LEN;
+    static constexpr int max_height = H > 0 ? H : ALPHABET_LEN;
+
+    // find_grids only ever places rows below the top one, so there have to be 4 for two of them to be the last
+    static constexpr bool can_offload = H == 0 || H >= 4;
+
+    int width() const { return W > 0 ? W : runtime_width; }
+    int height() const { return H > 0 ? H : runtime_height; }
+
+    void find_grids(const int depth, const std::uint32_t word_index)
+    {
+        if(!place_row(depth, word_index))
+            return;
+
+        // leave the last two rows to the offload solver
+        if constexpr(can_offload)
+        {
+            if(offload && depth + 3 == height())
+            {
+                add_subproblem(depth + 1);
+                return;
+            }
+        }
+
+        // continue next row with newly reduced list
+        for_each_candidate(depth + 1, [this, depth](const std::uint32_t next_word)
+        {
+            if(progress.stop.load(std::memory_order_relaxed) || branch_done)
+                return false;
+            find_grids(depth + 1, next_word);
+            return true;
+        });
+    }
+
+    // call f with each candidate for row depth that starts with an allowed letter, until f returns false
+    template <typename F>
+    void for_each_candidate(const int depth, F && f)
+    {
+        const auto & word_list = candidates[depth];
+        const auto & starts = letter_starts[depth];
+
+        // visit the letters in a random order, and each letter's words from a random place, wrapping around
+        if(randomize)
+        {
+            std::array<int, ALPHABET_LEN> letters;
+            int num_letters = 0;
+            for(auto l = first_letters[depth]; l != 0; l &= l - 1)
+                letters[num_letters++] = lowest_letter(l);
+            std::shuffle(letters.begin(), letters.begin() + num_letters, rng);
+
+            for(int i = 0; i < num_letters; ++i)
+            {
+                const auto begin = starts[letters[i]], end = starts[letters[i] + 1];
+                if(begin == end)
+                    continue;
+
+                const auto middle = begin + static_cast<std::uint32_t>(rng() % (end - begin));
+                for(auto j = middle; j < end; ++j)
+                {
+                    if(!f(word_list[j]))
+                        return;
+                }
+                for(auto j = begin; j < middle; ++j)
+                {
+                    if(!f(word_list[j]))
+                        return;
+                }
+            }
+            return;
+        }
+
+        for(auto letters = first_letters[depth]; letters != 0; letters &= letters - 1)
+        {
+            auto letter = lowest_letter(letters);
+            for(auto i = starts[letter]; i < starts[letter + 1]; ++i)
+            {
+                if(!f(word_list[i]))
+                    return;
+            }
+        }
+    }
+
+    // add the grid with rows above depth placed to the batch for the offload solver, which the last two rows are
+    // picked from the candidates for. The trie decides which can start a row, so the whole list is passed
+    void add_subproblem(const int depth)
+    {
+        offload::Subproblem subproblem;
+        std::copy_n(&cols[depth * max_width], width(), subproblem.cols.begin());
+        subproblem.first_candidate = subproblem_candidates.size();
+        subproblem.num_candidates = letter_starts[depth][ALPHABET_LEN];
+        subproblems.push_back(subproblem);
+
+        subproblem_candidates.insert(subproblem_candidates.end(), candidates[depth].begin(), candidates[depth].begin() + subproblem.num_candidates);
+        subproblem_rows.insert(subproblem_rows.end(), rows.begin(), rows.begin() + depth);
+
+        if(subproblems.size() >= offload_batch_size || subproblem_candidates.size() >= offload_batch_size)
+            solve_subproblems();
+    }
+
+    // hand the batch to the offload solver, and output the grids it finishes
+    void solve_subproblems()
+    {
+        if(!can_offload || subproblems.empty())
+            return;
+
+        solutions.clear();
+        offload->solve(subproblems, subproblem_candidates, solutions);
+
+        // the search's own rows are still needed above the subproblem being added
+        const auto placed = height() - 2;
+        std::array<std::uint32_t, max_height> grid_rows;
+        for(const auto & solution: solutions)
+        {
+            std::copy_n(&subproblem_rows[solution.subproblem * placed], placed, grid_rows.begin());
+            grid_rows[placed] = solution.rows[0];
+            grid_rows[placed + 1] = solution.rows[1];
+
+            ++stats.depths[height() - 1].grids;
+            if(record)
+                Solution_file::write_record(*record, grid_rows.data(), height(), record_index_bytes);
+            if(!count_only)
+                write_grid(output, job, grid_rows.data());
+        }
+
+        subproblems.clear();
+        subproblem_candidates.clear();
+        subproblem_rows.clear();
+    }
+
+    // can the column at node be continued with rows_left more letters, the first from first and the rest from letters, without repeating one
+    bool can_complete(const Prefix_trie::Node_id node, const int rows_left, const Letter_mask first, const Letter_mask letters) const
+    {
+        if(rows_left == 0)
+            return true;
+
+        for(auto next = col_prefixes.nodes[node].letters & first; next != 0; next &= next - 1)
+        {
+            auto letter = lowest_letter(next);
+            if(can_complete(col_prefixes.nodes[node].next[letter], rows_left - 1, letters & ~(Letter_mask{1} << letter), letters & ~(Letter_mask{1} << letter)))
+                return true;
+        }
+        return false;
+    }
+
+    // try to put row_words[word_index] in row depth. If it fits and it's the last row, print the grid.
+    // If it fits and there are more rows to go, fill in the candidates for the next row and return true
+    bool place_row(const int depth, const std::uint32_t word_index)
+    {
+        auto & depth_stats = stats.depths[depth];
+        ++depth_stats.nodes;
+
+        const auto * word = row_words.word(word_index);
+
+        // check to see if adding this word would fit prefixes
+        const auto * col = &cols[depth * max_width];
+        auto * next_col = &cols[(depth + 1) * max_width];
+        for(int i = 0; i < width(); ++i)
+        {
+            ++stats.prefix_lookups;
+            next_col[i] = col_prefixes.next(col[i], word[i]);
+            if(next_col[i] == Prefix_trie::none)
+            {
+                ++depth_stats.prefix_rejects;
+                return false;
+            }
+        }
+
+        rows[depth] = word_index;
+
+        // if this is the last row, print, continue
+        if(depth == height() - 1)
+        {
+            if(limit != 0)
+            {
+                auto found = progress.found.fetch_add(1, std::memory_order_relaxed) + 1;
+                if(found == 1)
+                    progress.first_grid.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+                if(found >= limit)
+                    progress.stop.store(true, std::memory_order_relaxed);
+                if(found > limit)
+                    return false; // another thread found the last one first
+            }
+
+            // when sampling, move on to other top rows for the next grid
+            branch_done = randomize;
+
+            ++depth_stats.grids;
+            if(record)
+                Solution_file::write_record(*record, rows.data(), height(), record_index_bytes);
+            if(count_only)
+                return false;
+
+            write_grid(output, job, rows.data());
+            return false;
+        }
+
+        const auto next_used = used[depth] | row_words.masks[word_index];
+        used[depth + 1] = next_used;
+
+        // every column has to be able to continue with a letter we haven't used yet.
+        // Whatever the first column can continue with is what the next row can start with
+        std::array<Letter_mask, max_width> allowed;
+        for(int i = 0; i < width(); ++i)
+        {
+            allowed[i] = col_prefixes.nodes[next_col[i]].letters & ~next_used;
+            if(allowed[i] == 0)
+            {
+                ++depth_stats.prefix_rejects;
+                return false;
+            }
+        }
+        first_letters[depth + 1] = allowed[0];
+
+        // a square grid and its transpose differ first where the top row meets the left column: at the top row's
+        // 2nd letter vs. the 2nd row's 1st. To find only one of each pair, require the 2nd row's to be greater.
+        // Rows further down may still start with any letter
+        if(canonical && depth == 0)
+        {
+            first_letters[1] &= ~((Letter_mask{2} << (word[1] - 'A')) - 1);
+            if(first_letters[1] == 0)
+                return false;
+        }
+
+        // generate new list of words, removing any that share a letter with this one (or any previous row).
+        // Words starting with a used letter are skipped a group at a time
+        const auto & word_list = candidates[depth];
+        const auto & word_masks = candidate_masks[depth];
+        const auto & starts = letter_starts[depth];
+        auto & next_word_list = candidates[depth + 1];
+        auto & next_word_masks = candidate_masks[depth + 1];
+        auto & next_starts = letter_starts[depth + 1];
+
+        std::uint32_t next_size = 0;
+        for(int letter = 0; letter < ALPHABET_LEN; ++letter)
+        {
+            next_starts[letter] = next_size;
+            if(next_used & (Letter_mask{1} << letter))
+                continue;
+
+            next_size += filter(&word_list[starts[letter]], &word_masks[starts[letter]], starts[letter + 1] - starts[letter],
+                    next_used, &next_word_list[next_size], &next_word_masks[next_size]);
+        }
+        next_starts[ALPHABET_LEN] = next_size;
+        stats.depths[depth + 1].overlap_rejects += starts[ALPHABET_LEN] - next_size;
+
+        // forward check: every empty cell needs a letter that its column's trie allows, that isn't used yet, and that
+        // some word that can still go in a row below has somewhere, not necessarily in that place. Each column has to be
+        // completable with such letters.
+        // With only one row left, trying each candidate is the same check, so it's skipped
+        const auto rows_left = height() - depth - 1;
+        if(rows_left > 1)
+        {
+            Letter_mask reachable = 0;
+            for(std::uint32_t i = 0; i < next_size; ++i)
+                reachable |= next_word_masks[i];
+
+            // no letter can be used twice, so the unused letters that some remaining word still has must be enough
+            // for every empty cell. Unused letters no candidate has are lost for good, which adds up on big grids
+            if(__builtin_popcountll(reachable) < rows_left * width())
+            {
+                ++depth_stats.forward_rejects;
+                return false;
+            }
+
+            for(int c = 0; c < width(); ++c)
+            {
+                auto first = allowed[c] & reachable & (c == 0 ? first_letters[depth + 1] : ~Letter_mask{0});
+                if(!can_complete(next_col[c], rows_left, first, reachable & ~next_used))
+                {
+                    ++depth_stats.forward_rejects;
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    const Search_job & job;
+    const Word_list & row_words;
+    const Prefix_trie & col_prefixes;
+    const int runtime_width;
+    const int runtime_height;
+    const bool canonical; // skip grids that are the transpose of one we'd find
+    const bool count_only;
+    const std::uint64_t limit;
+    Job_progress & progress;
+    Output_writer::Buffer & output;
+    const Filter_function filter;
+
+    using Letter_starts = std::array<std::uint32_t, ALPHABET_LEN + 1>;
+
+    std::vector<std::vector<std::uint32_t>> candidates; // indexes into row_words of words that may go in each row
+    std::vector<std::vector<Letter_mask>> candidate_masks; // masks of the words in candidates, packed for filtering
+    std::array<Letter_starts, max_height> letter_starts{}; // where each first letter's words start in candidates
+    std::array<Letter_mask, max_height> first_letters{};   // letters each row may start with
+    std::array<Prefix_trie::Node_id, (max_height + 1) * max_width> cols; // column trie nodes before each row: cols[depth * max_width + col]
+    std::array<Letter_mask, max_height + 1> used{};        // letters used by the rows above each depth
+    std::array<std::uint32_t, max_height> rows{};          // index of the word placed in each row
+
+    std::optional<std::uint32_t> top_row;               // word set by the last call to set_top_row
+    std::vector<std::uint32_t> second_rows;             // candidates for the 2nd row below top_row
+    std::size_t num_second_rows = 0;
+
+    std::optional<Output_writer::Buffer> record;        // for job.record, if set
+    const std::uint32_t record_index_bytes;
+
+    const bool randomize;      // for job.random_seed
+    const std::uint64_t seed;
+    std::mt19937_64 rng;
+    bool branch_done = false;  // set once a grid is found below the current top two rows, when randomizing
+
+    static constexpr std::size_t offload_batch_size = 1 << 16; // subproblems, or candidates, to collect before solving them
+    Bottom_rows_solver * const offload;                 // for job.offload
+    std::vector<offload::Subproblem> subproblems;       // waiting to be solved
+    std::vector<std::uint32_t> subproblem_candidates;
+    std::vector<std::uint32_t> subproblem_rows;         // the rows placed above each subproblem, height() - 2 apart
+    std::vector<offload::Solution> solutions;
+
+    Search_stats stats;
+};
+
+// search that fills the grid a row or a column at a time, always choosing between the next row and
+// the next column by which has fewer words that fit. Rows are filled top to bottom and columns left to
+// right, so the filled cells are always the top rows and the left columns, and every unfilled row and
+// column has a known prefix. Candidates are found by walking the row or column trie, only following
+// letters the crossing lines' tries allow, so every candidate fits. This does much better than filling
+// rows in order on long, thin grids, where the short lines are far more constrained.
+//
+// The top row is always placed first, so the work queue can hand out top rows and the choices below them
+class Adaptive_search final: public Search_engine
+{
+public:
+    Adaptive_search(const Search_job & job, Job_progress & progress, Output_writer::Buffer & output):
+        job{job},
+        row_prefixes{job.row_words->prefixes},
+        col_prefixes{*job.col_prefixes},
+        row_words{*job.row_words},
+        width{job.width},
+        height{job.height},
+        canonical{job.canonical && job.width == job.height && job.width > 1},
+        count_only{job.count_only},
+        limit{job.limit},
+        progress{progress},
+        output{output},
+        record_index_bytes{Solution_file::get_index_bytes(row_words.size())}
+    {
+        if(job.record)
+            record.emplace(*job.record);
+
+        auto & start = states[0];
+        start.row_nodes.fill(Prefix_trie::root);
+        start.col_nodes.fill(Prefix_trie::root);
+
+        // the second line is either a row or a column, and there's at most one of each word for it
+        second_lines.resize(std::max(row_words.size(), job.col_prefixes->nodes.size) * max_dim);
+    }
+
+    std::size_t set_top_row(const std::uint32_t first_word) override
+    {
+        auto allocations = thread_allocations;
+
+        top_row = first_word;
+        num_second_lines = 0;
+
+        // place the top row, if every column can start with its letter
+        const auto * word = row_words.word(first_word);
+        auto & next = states[1];
+        next = states[0];
+        ++stats.depths[0].nodes;
+        for(int j = 0; j < width; ++j)
+        {
+            ++stats.prefix_lookups;
+            next.col_nodes[j] = col_prefixes.next(Prefix_trie::root, word[j]);
+            if(next.col_nodes[j] == Prefix_trie::none)
+            {
+                ++stats.depths[0].prefix_rejects;
+                return 0;
+            }
+            grid[j] = word[j];
+        }
+        next.used = row_words.masks[first_word];
+        next.rows = 1;
+
+        if(complete(1))
+        {
+            stats.allocations += thread_allocations - allocations;
+            return 0;
+        }
+
+        // list every word that can go in the second line, so they can be handed out separately
+        second_line_is_row = choose_row(1);
+        for_each_candidate(1, second_line_is_row, [this](const Letter_mask)
+        {
+            const auto & state = states[1];
+            auto start = second_line_is_row ? state.cols : state.rows;
+            auto length = second_line_is_row ? width : height;
+            for(int pos = start; pos < length; ++pos)
+                second_lines[num_second_lines * max_dim + pos] = second_line_is_row ? grid[state.rows * width + pos] : grid[pos * width + state.cols];
+            ++num_second_lines;
+            return true;
+        });
+
+        stats.allocations += thread_allocations - allocations;
+        return num_second_lines;
+    }
+
+    void search_second_row(const std::size_t index) override
+    {
+        auto allocations = thread_allocations;
+
+        // walk the chosen line's letters again to set up the state after it
+        auto & state = states[1];
+        auto & next = states[2];
+        next = state;
+        ++stats.depths[1].nodes;
+
+        auto start = second_line_is_row ? state.cols : state.rows;
+        auto length = second_line_is_row ? width : height;
+        for(int pos = start; pos < length; ++pos)
+        {
+            auto letter = second_lines[index * max_dim + pos];
+            auto & crossing = second_line_is_row ? next.col_nodes[pos] : next.row_nodes[pos];
+            ++stats.prefix_lookups;
+            crossing = (second_line_is_row ? col_prefixes : row_prefixes).next(crossing, letter);
+            next.used |= Letter_mask{1} << (letter - 'A');
+            (second_line_is_row ? grid[state.rows * width + pos] : grid[pos * width + state.cols]) = letter;
+        }
+        if(second_line_is_row)
+            ++next.rows;
+        else
+            ++next.cols;
+
+        if(!complete(2))
+            find_grids(2);
+
+        stats.allocations += thread_allocations - allocations;
+    }
+
+    std::optional<std::uint32_t> get_top_row() const override { return top_row; }
+    const Search_stats & get_stats() const override { return stats; }
+
+private:
+    static constexpr int max_dim = ALPHABET_LEN;
+
+    // which cells are filled. The filled rows' nodes and the filled columns' nodes aren't used again
+    struct State
+    {
+        std::array<Prefix_trie::Node_id, max_dim> row_nodes; // row trie node of each unfilled row's prefix
+        std::array<Prefix_trie::Node_id, max_dim> col_nodes; // column trie node of each unfilled column's prefix
+        Letter_mask used = 0;
+        int rows = 0; // rows filled
+        int cols = 0; // columns filled
+    };
+
+    // if states[step] is a full grid, print it and return true
+    bool complete(const int step)
+    {
+        const auto & state = states[step];
+        if(state.rows < height && state.cols < width)
+            return false;
+
+        if(limit != 0)
+        {
+            auto found = progress.found.fetch_add(1, std::memory_order_relaxed) + 1;
+            if(found == 1)
+                progress.first_grid.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+            if(found >= limit)
+                progress.stop.store(true, std::memory_order_relaxed);
+            if(found > limit)
+                return true; // another thread found the last one first
+        }
+
+        ++stats.depths[step - 1].grids;
+        if(count_only && !record)
+            return true;
+
+        // the grid is filled in letters, so find which word each row is. Text is the same either way
+        std::array<std::uint32_t, max_dim> rows;
+        const auto text_only = job.format == Output_format::text && !record;
+        for(int i = 0; i < height && !text_only; ++i)
+            rows[i] = row_words.find(&grid[i * width]);
+
+        if(record)
+            Solution_file::write_record(*record, rows.data(), height, record_index_bytes);
+        if(count_only)
+            return true;
+
+        if(!text_only)
+        {
+            write_grid(output, job, rows.data());
+            return true;
+        }
+
+        for(int i = 0; i < height; ++i)
+        {
+            put_letters(output, job, &grid[i * width], width);
+            output.put('\n');
+        }
+        output.put('\n');
+        output.end_record();
+
+        return true;
+    }
+
+    void find_grids(const int step)
+    {
+        auto row = choose_row(step);
+        for_each_candidate(step, row, [this, step](const Letter_mask)
+        {
+            if(progress.stop.load(std::memory_order_relaxed))
+                return false;
+
+            ++stats.depths[step].nodes;
+            if(!complete(step + 1))
+                find_grids(step + 1);
+            return true;
+        });
+    }
+
+    // should the next line be the next row, rather than the next column. Whichever has fewer candidates wins.
+    // The line chosen last time is counted first, as it's likely to be chosen again, and counting the other
+    // stops once it's no better. So this usually costs about as much as listing the chosen line's candidates
+    bool choose_row(const int step)
+    {
+        const auto & state = states[step];
+        if(state.rows == height)
+            return false;
+        if(state.cols == width)
+            return true;
+
+        auto first = step > 1 ? last_choices[step - 1] : width <= height;
+
+        std::size_t num_first = 0;
+        for_each_candidate(step, first, [&num_first](const Letter_mask) { ++num_first; return true; });
+
+        std::size_t num_second = 0;
+        if(num_first > 0)
+            for_each_candidate(step, !first, [&num_second, num_first](const Letter_mask) { return ++num_second < num_first; });
+
+        last_choices[step] = num_first == 0 || num_first <= num_second ? first : !first;
+        return last_choices[step];
+    }
+
+    // call f for each word that fits in the next row (or column), with its letters written to grid and
+    // the state after placing it in states[step + 1], until f returns false
+    template <typename F>
+    void for_each_candidate(const int step, const bool row, F && f)
+    {
+        const auto & state = states[step];
+        auto & next = states[step + 1];
+        next = state;
+
+        if(row)
+        {
+            ++next.rows;
+            extend(step, true, state.cols, state.row_nodes[state.rows], state.used, f);
+        }
+        else
+        {
+            ++next.cols;
+            extend(step, false, state.rows, state.col_nodes[state.cols], state.used, f);
+        }
+    }
+
+    // fill in the line from pos on, following its own trie from node, and the crossing lines' tries. Returns false to stop
+    template <typename F>
+    bool extend(const int step, const bool row, const int pos, const Prefix_trie::Node_id node, const Letter_mask used, F & f)
+    {
+        const auto & state = states[step];
+        auto & next = states[step + 1];
+
+        if(pos == (row ? width : height))
+        {
+            next.used = used;
+            return f(used);
+        }
+
+        const auto & own = row ? row_prefixes : col_prefixes;
+        const auto & crossing = row ? col_prefixes : row_prefixes;
+        const auto crossing_node = row ? state.col_nodes[pos] : state.row_nodes[pos];
+        auto & cell = row ? grid[state.rows * width + pos] : grid[pos * width + state.cols];
+        auto & next_crossing = row ? next.col_nodes[pos] : next.row_nodes[pos];
+
+        auto letters = own.nodes[node].letters & crossing.nodes[crossing_node].letters & ~used;
+
+        // a square grid and its transpose differ first at cells (0, 1) and (1, 0). To find only one of each pair, require (1, 0)'s letter to be greater
+        if(canonical && (row ? state.rows == 1 && pos == 0 : state.cols == 0 && pos == 1))
+            letters &= ~((Letter_mask{2} << (grid[1] - 'A')) - 1);
+
+        for(; letters != 0; letters &= letters - 1)
+        {
+            auto letter = lowest_letter(letters);
+            stats.prefix_lookups += 2;
+            cell = 'A' + letter;
+            next_crossing = crossing.nodes[crossing_node].next[letter];
+            if(!extend(step, row, pos + 1, own.nodes[node].next[letter], used | (Letter_mask{1} << letter), f))
+                return false;
+        }
+        return true;
+    }
+
+    const Search_job & job;
+    const Prefix_trie & row_prefixes;
+    const Prefix_trie & col_prefixes;
+    const Word_list & row_words;
+    const int width;
+    const int height;
+    const bool canonical; // skip grids that are the transpose of one we'd find
+    const bool count_only;
+    const std::uint64_t limit;
+    Job_progress & progress;
+    Output_writer::Buffer & output;
+
+    std::array<State, 2 * max_dim + 1> states; // before each step
+    std::array<char, max_dim * max_dim> grid{};   // grid[row * width + col]
+    std::array<bool, 2 * max_dim + 1> last_choices{}; // whether the line chosen at each step was a row
+
+    std::optional<std::uint32_t> top_row;
+    bool second_line_is_row = false;
+    std::vector<char> second_lines;             // letters of each candidate for the 2nd line, max_dim apart
+    std::size_t num_second_lines = 0;
+
+    std::optional<Output_writer::Buffer> record; // for job.record, if set
+    const std::uint32_t record_index_bytes;
+
+    Search_stats stats;
+};
+
+// search that treats filling the grid as an exact cover problem, and solves it with Knuth's Algorithm C:
+// dancing links, with colors. Every row and column is an item that exactly one option, a word for that
+// line, has to cover. Each cell is a secondary item, which every option through it colors with its letter
+// there, so crossing words have to agree. Each letter is a secondary item the row options cover as well,
+// so none is used twice. Each step picks the line with the fewest words left that fit, so like the
+// adaptive search, it fills rows or columns as the grid's shape suits.
+//
+// The links are all indexes into one flat array of nodes, with each option's nodes next to each other,
+// so hiding an option walks straight through memory. Each thread has its own copy, as searching rewires it.
+//
+// The top row is always placed first, so the work queue can hand out top rows and the choices below them
+class Exact_cover_search final: public Search_engine
+{
+public:
+    Exact_cover_search(const Search_job & job, Job_progress & progress, Output_writer::Buffer & output):
+        job{job},
+        row_words{*job.row_words},
+        width{job.width},
+        height{job.height},
+        canonical{job.canonical && job.width == job.height && job.width > 1},
+        count_only{job.count_only},
+        limit{job.limit},
+        progress{progress},
+        output{output},
+        num_primary{width + height},
+        num_items{num_primary + width * height + ALPHABET_LEN},
+        record_index_bytes{Solution_file::get_index_bytes(row_words.size())}
+    {
+        if(job.record)
+            record.emplace(*job.record);
+
+        // 0 heads the list of primary items, and num_items + 1 the secondary ones
+        items.resize(num_items + 2);
+        for(int i = 0; i <= num_items + 1; ++i)
+            items[i] = {i - 1, i + 1};
+        items[0].left = num_primary;
+        items[num_primary].right = 0;
+        items[num_primary + 1].left = num_items + 1;
+        items[num_items].right = num_primary + 1;
+        items[num_items + 1] = {num_items, num_primary + 1};
+
+        // each item's header node heads the list of its nodes, and counts them
+        nodes.resize(num_items + 1);
+        for(int i = 0; i <= num_items; ++i)
+            nodes[i] = {0, i, i, 0};
+        add_spacer();
+
+        for(int r = 0; r < height; ++r)
+        {
+            for(std::uint32_t w = 0; w < row_words.size(); ++w)
+            {
+                const auto * word = row_words.word(w);
+                if(r == 0)
+                    top_options.push_back(nodes.size());
+                add_node(row_item(r), 0);
+                for(int c = 0; c < width; ++c)
+                    add_node(cell_item(r, c), word[c] - 'A' + 1);
+                for(int c = 0; c < width; ++c)
+                    add_node(letter_item(word[c] - 'A'), 0);
+                option_words.push_back(w);
+                add_spacer();
+            }
+        }
+
+        std::vector<char> col_words;
+        std::string word;
+        add_col_words(*job.col_prefixes, Prefix_trie::root, word, col_words);
+        for(int c = 0; c < width; ++c)
+        {
+            for(std::size_t w = 0; w < col_words.size(); w += height)
+            {
+                add_node(col_item(c), 0);
+                for(int r = 0; r < height; ++r)
+                    add_node(cell_item(r, c), col_words[w + r] - 'A' + 1);
+                option_words.push_back(0); // not needed, the rows say which grid it is
+                add_spacer();
+            }
+        }
+
+        second_options.resize(std::max<std::size_t>(row_words.size(), col_words.size() / height));
+        canonical_hidden.reserve(row_words.size() + col_words.size() / height);
+    }
+
+    std::size_t set_top_row(const std::uint32_t first_word) override
+    {
+        auto allocations = thread_allocations;
+
+        clear_top_row();
+        top_row = first_word;
+        num_second_options = 0;
+
+        ++depth_stats(0).nodes;
+        cover(row_item(0));
+        commit_option(top_options[first_word]);
+        rows[0] = first_word;
+
+        // a square grid and its transpose differ first at cells (0, 1) and (1, 0). To find only one of each pair,
+        // take away every option that puts a letter at (1, 0) that isn't greater than the top row's at (0, 1)
+        if(canonical)
+        {
+            const auto item = cell_item(1, 0);
+            const auto max_color = row_words.word(first_word)[1] - 'A' + 1;
+            for(auto q = nodes[item].down; q != item; q = nodes[q].down)
+            {
+                if(nodes[q].color > 0 && nodes[q].color <= max_color)
+                {
+                    hide(q);
+                    unlink(q);
+                    canonical_hidden.push_back(q);
+                }
+            }
+        }
+
+        if(!complete(1, height - 1))
+        {
+            // list the options for the line with the fewest, so they can be handed out separately
+            second_item = choose_item();
+            if(nodes[second_item].top == 0)
+            {
+                ++depth_stats(1).prefix_rejects;
+                second_item = 0;
+            }
+            else
+            {
+                cover(second_item);
+                for(auto x = nodes[second_item].down; x != second_item; x = nodes[x].down)
+                    second_options[num_second_options++] = x;
+            }
+        }
+
+        stats.allocations += thread_allocations - allocations;
+        return num_second_options;
+    }
+
+    void search_second_row(const std::size_t index) override
+    {
+        auto allocations = thread_allocations;
+
+        const auto x = second_options[index];
+        ++depth_stats(1).nodes;
+        commit_option(x);
+        const bool row = is_row(second_item);
+        if(row)
+            rows[second_item - row_item(0)] = option_word(x);
+        find_grids(2, height - 1 - row);
+        uncommit_option(x);
+
+        stats.allocations += thread_allocations - allocations;
+    }
+
+    std::optional<std::uint32_t> get_top_row() const override { return top_row; }
+    const Search_stats & get_stats() const override { return stats; }
+
+private:
+    // the list of items not yet covered, in order
+    struct Item
+    {
+        int left = 0;
+        int right = 0;
+    };
+
+    // an item's header, one item of an option, or a spacer between options
+    struct Node
+    {
+        int top = 0;   // the node's item. For headers, the number of nodes in the list. For spacers, -the option before's index
+        int up = 0;    // previous node in the item's list. For spacers, the first node of the option before
+        int down = 0;  // next node in the item's list. For spacers, the last node of the option after
+        int color = 0; // letter index + 1 for cells, 0 for lines and letters, or -1 once the cell has that letter
+    };
+
+    int row_item(const int r) const { return 1 + r; }
+    int col_item(const int c) const { return 1 + height + c; }
+    int cell_item(const int r, const int c) const { return 1 + num_primary + r * width + c; }
+    int letter_item(const int letter) const { return 1 + num_primary + width * height + letter; }
+    bool is_row(const int item) const { return item <= height; }
+
+    // a 1 × 26 grid takes 27 choices to fill, one more than there are depths
+    Depth_stats & depth_stats(const int level) { return stats.depths[std::min(level, ALPHABET_LEN - 1)]; }
+
+    void add_node(const int item, const int color)
+    {
+        const int node = nodes.size();
+        nodes.push_back({item, nodes[item].up, item, color});
+        nodes[nodes[item].up].down = node;
+        nodes[item].up = node;
+        ++nodes[item].top;
+    }
+
+    // end the option just added, if any
+    void add_spacer()
+    {
+        const int spacer = nodes.size();
+        const int num_options = option_words.size();
+        if(num_options > 0)
+        {
+            nodes[last_spacer].down = spacer - 1;
+            nodes.push_back({-num_options, last_spacer + 1, 0, 0});
+        }
+        else
+            nodes.push_back({0, 0, 0, 0});
+        last_spacer = spacer;
+    }
+
+    // append every word in the column trie below node, which is word's prefix
+    void add_col_words(const Prefix_trie & col_prefixes, const Prefix_trie::Node_id node, std::string & word, std::vector<char> & words) const
+    {
+        if(static_cast<int>(word.size()) == height)
+        {
+            words.insert(words.end(), word.begin(), word.end());
+            return;
+        }
+        for(auto letters = col_prefixes.nodes[node].letters; letters != 0; letters &= letters - 1)
+        {
+            const auto letter = lowest_letter(letters);
+            word.push_back('A' + letter);
+            add_col_words(col_prefixes, col_prefixes.nodes[node].next[letter], word, words);
+            word.pop_back();
+        }
+    }
+
+    // index into row_words of the row option that node x is in
+    std::uint32_t option_word(int x) const
+    {
+        while(nodes[x].top > 0)
+            ++x;
+        return option_words[-nodes[x].top - 1];
+    }
+
+    // undo set_top_row, if it was called
+    void clear_top_row()
+    {
+        if(!top_row)
+            return;
+
+        if(second_item != 0)
+            uncover(second_item);
+        second_item = 0;
+
+        while(!canonical_hidden.empty())
+        {
+            relink(canonical_hidden.back());
+            unhide(canonical_hidden.back());
+            canonical_hidden.pop_back();
+        }
+
+        uncommit_option(top_options[*top_row]);
+        uncover(row_item(0));
+        top_row.reset();
+    }
+
+    // the uncovered line with the fewest options left. Ties go to rows, top to bottom, then columns
+    int choose_item() const
+    {
+        int best = 0;
+        auto best_size = std::numeric_limits<int>::max();
+        for(auto i = items[0].right; i != 0; i = items[i].right)
+        {
+            if(nodes[i].top < best_size)
+            {
+                best = i;
+                best_size = nodes[i].top;
+                if(best_size <= 1)
+                    break;
+            }
+        }
+        return best;
+    }
+
+    // if every row has been chosen, each column left has either the one word its cells spell, or nothing.
+    // Print the grid if that's a word for every column. Returns false if there are rows left
+    bool complete(const int level, const int rows_left)
+    {
+        if(rows_left > 0)
+            return false;
+
+        for(auto i = items[0].right; i != 0; i = items[i].right)
+        {
+            if(nodes[i].top == 0)
+            {
+                ++depth_stats(level).prefix_rejects;
+                return true;
+            }
+        }
+
+        if(limit != 0)
+        {
+            auto found = progress.found.fetch_add(1, std::memory_order_relaxed) + 1;
+            if(found == 1)
+                progress.first_grid.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+            if(found >= limit)
+                progress.stop.store(true, std::memory_order_relaxed);
+            if(found > limit)
+                return true; // another thread found the last one first
+        }
+
+        ++depth_stats(level - 1).grids;
+        if(record)
+            Solution_file::write_record(*record, rows.data(), height, record_index_bytes);
+        if(!count_only)
+            write_grid(output, job, rows.data());
+        return true;
+    }
+
+    void find_grids(const int level, const int rows_left)
+    {
+        if(complete(level, rows_left))
+            return;
+
+        const auto i = choose_item();
+        if(nodes[i].top == 0)
+        {
+            ++depth_stats(level).prefix_rejects;
+            return;
+        }
+
+        cover(i);
+        const bool row = is_row(i);
+        for(auto x = nodes[i].down; x != i; x = nodes[x].down)
+        {
+            if(progress.stop.load(std::memory_order_relaxed))
+                break;
+
+            ++depth_stats(level).nodes;
+            commit_option(x);
+            if(row)
+                rows[i - row_item(0)] = option_word(x);
+            find_grids(level + 1, rows_left - row);
+            uncommit_option(x);
+        }
+        uncover(i);
+    }
+
+    // commit every item in x's option but x's own
+    void commit_option(const int x)
+    {
+        for(auto p = x + 1; p != x;)
+        {
+            if(nodes[p].top <= 0)
+                p = nodes[p].up;
+            else
+                commit(p++);
+        }
+    }
+
+    void uncommit_option(const int x)
+    {
+        for(auto p = x - 1; p != x;)
+        {
+            if(nodes[p].top <= 0)
+                p = nodes[p].down;
+            else
+                uncommit(p--);
+        }
+    }
+
+    // cover p's item if it's uncolored, or keep only the options that color it the same, if not done already
+    void commit(const int p)
+    {
+        if(nodes[p].color == 0)
+            cover(nodes[p].top);
+        else if(nodes[p].color > 0)
+            purify(p);
+    }
+
+    void uncommit(const int p)
+    {
+        if(nodes[p].color == 0)
+            uncover(nodes[p].top);
+        else if(nodes[p].color > 0)
+            unpurify(p);
+    }
+
+    // take item i out of the list, and every option with it out of the other items' lists
+    void cover(const int i)
+    {
+        for(auto p = nodes[i].down; p != i; p = nodes[p].down)
+            hide(p);
+        const auto [left, right] = items[i];
+        items[left].right = right;
+        items[right].left = left;
+    }
+
+    void uncover(const int i)
+    {
+        const auto [left, right] = items[i];
+        items[left].right = i;
+        items[right].left = i;
+        for(auto p = nodes[i].up; p != i; p = nodes[p].up)
+            unhide(p);
+    }
+
+    void purify(const int p)
+    {
+        const auto color = nodes[p].color, i = nodes[p].top;
+        for(auto q = nodes[i].down; q != i; q = nodes[q].down)
+        {
+            if(nodes[q].color == color)
+                nodes[q].color = -1;
+            else
+                hide(q);
+        }
+    }
+
+    void unpurify(const int p)
+    {
+        const auto color = nodes[p].color, i = nodes[p].top;
+        for(auto q = nodes[i].up; q != i; q = nodes[q].up)
+        {
+            if(nodes[q].color < 0)
+                nodes[q].color = color;
+            else
+                unhide(q);
+        }
+    }
+
+    // take the other nodes of p's option out of their items' lists. Cells already known to have a node's color keep it
+    void hide(const int p)
+    {
+        for(auto q = p + 1; q != p;)
+        {
+            const auto & node = nodes[q];
+            if(node.top <= 0)
+                q = node.up;
+            else
+            {
+                if(node.color >= 0)
+                    unlink(q);
+                ++q;
+            }
+        }
+    }
+
+    void unhide(const int p)
+    {
+        for(auto q = p - 1; q != p;)
+        {
+            const auto & node = nodes[q];
+            if(node.top <= 0)
+                q = node.down;
+            else
+            {
+                if(node.color >= 0)
+                    relink(q);
+                --q;
+            }
+        }
+    }
+
+    void unlink(const int q)
+    {
+        auto & node = nodes[q];
+        nodes[node.up].down = node.down;
+        nodes[node.down].up = node.up;
+        --nodes[node.top].top;
+    }
+
+    void relink(const int q)
+    {
+        auto & node = nodes[q];
+        nodes[node.up].down = q;
+        nodes[node.down].up = q;
+        ++nodes[node.top].top;
+    }
+
+    const Search_job & job;
+    const Word_list & row_words;
+    const int width;
+    const int height;
+    const bool canonical; // skip grids that are the transpose of one we'd find
+    const bool count_only;
+    const std::uint64_t limit;
+    Job_progress & progress;
+    Output_writer::Buffer & output;
+
+    const int num_primary; // the rows, then the columns
+    const int num_items;   // then the cells, row by row, then the letters
+
+    std::vector<Item> items;
+    std::vector<Node> nodes;
+    std::vector<std::uint32_t> option_words; // index into row_words of each option, if it's a row's
+    std::vector<int> top_options;            // the first node of each word's option for the top row
+    int last_spacer = 0;
+
+    std::array<std::uint32_t, ALPHABET_LEN> rows{}; // index of the word chosen for each row
+
+    std::optional<std::uint32_t> top_row;
+    int second_item = 0;                   // the line covered below the top row, or 0 if none
+    std::vector<int> second_options;       // its options, by their nodes
+    std::size_t num_second_options = 0;
+    std::vector<int> canonical_hidden;     // options taken away by set_top_row for a canonical search
+
+    std::optional<Output_writer::Buffer> record; // for job.record, if set
+    const std::uint32_t record_index_bytes;
+
+    Search_stats stats;
+};
+
+// every grid size small enough to have a Grid_search specialized for it
+constexpr int max_specialized_dim = 8;
+
+constexpr bool is_specialized(const int width, const int height)
+{
+    return width <= max_specialized_dim && height <= max_specialized_dim && width * height <= ALPHABET_LEN;
+}
+
+using Search_factory = std::unique_ptr<Search_engine> (*)(const Search_job &, Job_progress &, Output_writer::Buffer &);
+
+template <int W, int H>
+std::unique_ptr<Search_engine> make_grid_search(const Search_job & job, Job_progress & progress, Output_writer::Buffer & output)
+{
+    return std::make_unique<Grid_search<W, H>>(job, progress, output);
+}
+
+// table of make_grid_search<W, H>, indexed by [W - 1][H - 1], with sizes that aren't specialized using the run time sized search
+template <std::size_t... I>
+constexpr auto make_search_factories(std::index_sequence<I...>)
+{
+    constexpr int n = max_specialized_dim;
+    return std::array<Search_factory, sizeof...(I)>
+    {
+        (is_specialized(I / n + 1, I % n + 1) ? &make_grid_search<is_specialized(I / n + 1, I % n + 1) ? I / n + 1 : 0,
+                                                                is_specialized(I / n + 1, I % n + 1) ? I % n + 1 : 0>
+                                              : &make_grid_search<0, 0>)...
+    };
+}
+
+constexpr auto search_factories = make_search_factories(std::make_index_sequence<max_specialized_dim * max_specialized_dim>{});
+
+// create the search for a job, using the version specialized for its size if there is one
+std::unique_ptr<Search_engine> make_search(const Search_job & job, Job_progress & progress, Output_writer::Buffer & output)
+{
+    if(job.engine == Engine::adaptive)
+        return std::make_unique<Adaptive_search>(job, progress, output);
+    if(job.engine == Engine::dlx)
+        return std::make_unique<Exact_cover_search>(job, progress, output);
+
+    if(is_specialized(job.width, job.height))
+        return search_factories[(job.width - 1) * max_specialized_dim + job.height - 1](job, progress, output);
+    return make_grid_search<0, 0>(job, progress, output);
+}
+
+// list the CPUs the process is allowed to run on
+std::vector<int> get_allowed_cpus()
+{
+    std::vector<int> cpus;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(sched_getaffinity(0, sizeof(set), &set) == 0)
+    {
+        for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if(CPU_ISSET(cpu, &set))
+                cpus.push_back(cpu);
+        }
+    }
+    else
+        std::cerr<<"Could not get CPU affinity: "<<std::strerror(errno)<<"\n";
+
+    return cpus;
+}
+
+// restrict the calling thread to run only on the given CPU
+void pin_thread(const int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if(auto err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set); err != 0)
+        std::cerr<<"Could not pin thread to CPU "<<cpu<<": "<<std::strerror(err)<<"\n";
+}
+
+// split the top row words into num_shards contiguous ranges of about the same estimated work, and return the
+// shard'th (counting from 0). A top word's work is estimated from how many ways each column could continue below
+// it, multiplied together. The split only depends on the word lists, so every machine working on a search agrees
+std::vector<std::uint32_t> get_shard(const Word_list & row_words, const Prefix_trie & col_prefixes, const int height,
+        const int shard, const int num_shards)
+{
+    std::vector<double> costs(row_words.size());
+    for(std::size_t i = 0; i < row_words.size(); ++i)
+    {
+        // even a top word that can't be continued costs something to try
+        double cost = 1.0;
+        if(height > 1)
+        {
+            const auto * word = row_words.word(i);
+            for(std::size_t col = 0; col < row_words.length; ++col)
+            {
+                auto node = col_prefixes.next(Prefix_trie::root, word[col]);
+                auto letters = node == Prefix_trie::none ? 0 : col_prefixes.nodes[node].letters & ~row_words.masks[i];
+                cost *= __builtin_popcountll(letters);
+            }
+            cost += 1.0;
+        }
+        costs[i] = cost;
+    }
+
+    const auto total = std::accumulate(costs.begin(), costs.end(), 0.0);
+
+    // each word goes in the shard its starting point in the total falls in
+    std::vector<std::uint32_t> top_words;
+    double start = 0.0;
+    for(std::size_t i = 0; i < costs.size(); ++i)
+    {
+        auto word_shard = std::min(static_cast<int>(start / total * num_shards), num_shards - 1);
+        if(word_shard == shard)
+            top_words.push_back(static_cast<std::uint32_t>(i));
+        start += costs[i];
+    }
+
+    return top_words;
+}
+
+// hands out the search to worker threads in small pieces. Threads first claim
+// whole top row words, in order, working through each job in turn. Once those
+// have all been claimed, idle threads help finish the top words other threads
+// are still working on, by claiming second row words from them one at a time.
+// None of this takes a lock, except to pause the threads while a checkpoint is taken
+class Work_queue
+{
+public:
+    // what one thread did
+    struct Thread_stats
+    {
+        std::vector<Search_stats> jobs;                   // stats for the work done on each job
+        std::chrono::steady_clock::duration busy{};       // time spent searching, rather than looking for work
+    };
+
+    // how far the search has gotten. Every second row word a thread has claimed has been searched
+    // by the time the threads are paused, so each top word's progress is just how many have been claimed
+    struct Snapshot
+    {
+        static constexpr std::uint32_t finished = std::numeric_limits<std::uint32_t>::max();
+
+        std::vector<std::uint32_t> tasks; // second row words searched below each top word, or finished
+        std::vector<Search_stats> stats;  // for each job
+    };
+
+    // with track_progress set, progress is counted after every second row for the nodes() and tasks_finished()
+    // methods. Otherwise each thread's nodes are only counted once it runs out of work
+    Work_queue(const std::vector<Search_job> & jobs, Output_writer & writer, const std::size_t num_threads, const bool track_progress):
+        jobs{jobs},
+        writer{writer},
+        track_progress{track_progress},
+        progress(jobs.size()),
+        thread_nodes(num_threads),
+        workers(num_threads),
+        base_stats(jobs.size())
+    {
+        // every job's top words go in one list, so all jobs share one counter
+        std::size_t num_tasks = 0;
+        for(const auto & job: jobs)
+        {
+            job_starts.push_back(num_tasks);
+            num_tasks += job.top_words.size();
+        }
+        tasks = std::vector<Task>(num_tasks);
+    }
+
+    // skip the work done in an earlier run. Call before run
+    void restore(const Snapshot & snapshot)
+    {
+        resume_from = snapshot.tasks;
+        base_stats = snapshot.stats;
+
+        for(std::size_t job = 0; job < jobs.size(); ++job)
+        {
+            auto found = base_stats[job].grids();
+            progress[job].found = found;
+            if(jobs[job].limit != 0 && found >= jobs[job].limit)
+                progress[job].stop = true;
+        }
+
+        for(std::size_t t = 0; t < tasks.size(); ++t)
+            num_resumed += resume_from[t] == Snapshot::finished || progress[get_job(t).first].stop.load(std::memory_order_relaxed);
+    }
+
+    // claim and search work until there is none left. Returns stats for the work done by this thread
+    Thread_stats run(const std::size_t thread)
+    {
+        Thread_stats stats;
+        auto & nodes = thread_nodes[thread].nodes;
+
+        Worker worker{writer, jobs.size()};
+        auto get_search = [this, &worker](const std::size_t job) -> Search_engine &
+        {
+            if(!worker.searches[job])
+                worker.searches[job] = make_search(jobs[job], progress[job], worker.output);
+            return *worker.searches[job];
+        };
+
+        {
+            std::scoped_lock lock{pause_mutex};
+            workers[thread] = &worker;
+            ++num_running;
+        }
+
+        // first pass: claim unstarted top words
+        while(true)
+        {
+            if(pause_requested.load(std::memory_order_relaxed))
+                pause_point(worker);
+
+            auto t = next_task.fetch_add(1, std::memory_order_relaxed);
+            if(t >= tasks.size())
+                break;
+
+            auto [job, top] = get_job(t);
+            auto & task = tasks[t];
+
+            // once a job has found enough grids, the rest of its top words are skipped, as are any finished in an earlier run
+            auto done_before = resume_from.empty() ? 0 : resume_from[t];
+            if(progress[job].stop.load(std::memory_order_relaxed) || done_before == Snapshot::finished)
+            {
+                task.size.store(0, std::memory_order_release);
+                ++num_published;
+                num_finished.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+
+            auto start = std::chrono::steady_clock::now();
+
+            auto & search = get_search(job);
+            auto size = static_cast<std::uint32_t>(search.set_top_row(top));
+            task.next.store(std::min(done_before, size), std::memory_order_relaxed);
+            task.done.store(std::min(done_before, size), std::memory_order_relaxed);
+            task.size.store(size, std::memory_order_release);
+            ++num_published;
+            if(done_before >= size)
+                num_finished.fetch_add(1, std::memory_order_relaxed);
+
+            run_second_rows(search, task, jobs[job], progress[job], worker, nodes);
+
+            stats.busy += std::chrono::steady_clock::now() - start;
+        }
+
+        // second pass: help with top words that are still in progress, taking the one with the most unclaimed work first
+        while(true)
+        {
+            if(pause_requested.load(std::memory_order_relaxed))
+                pause_point(worker);
+
+            std::size_t best = tasks.size();
+            std::uint32_t best_remaining = 0;
+            for(std::size_t job = 0; job < jobs.size(); ++job)
+            {
+                if(progress[job].stop.load(std::memory_order_relaxed))
+                    continue;
+
+                auto end = job + 1 < jobs.size() ? job_starts[job + 1] : tasks.size();
+                for(auto i = job_starts[job]; i < end; ++i)
+                {
+                    auto remaining = tasks[i].remaining();
+                    if(remaining > best_remaining)
+                    {
+                        best = i;
+                        best_remaining = remaining;
+                    }
+                }
+            }
+
+            if(best == tasks.size())
+            {
+                // a top word claimed by another thread may not have its second rows listed yet
+                if(num_published == tasks.size())
+                    break;
+                std::this_thread::yield();
+                continue;
+            }
+
+            auto start = std::chrono::steady_clock::now();
+
+            auto [job, top] = get_job(best);
+            auto & search = get_search(job);
+            if(search.get_top_row() != top)
+                search.set_top_row(top);
+
+            run_second_rows(search, tasks[best], jobs[job], progress[job], worker, nodes);
+
+            stats.busy += std::chrono::steady_clock::now() - start;
+        }
+
+        // everything this thread found has to be out before a checkpoint can count it as done
+        worker.output.flush();
+
+        stats.jobs.resize(jobs.size());
+        std::size_t total_nodes = 0;
+        for(std::size_t job = 0; job < jobs.size(); ++job)
+        {
+            if(worker.searches[job])
+            {
+                stats.jobs[job] = worker.searches[job]->get_stats();
+                total_nodes += stats.jobs[job].nodes();
+            }
+        }
+        nodes.store(total_nodes, std::memory_order_relaxed);
+
+        {
+            std::scoped_lock lock{pause_mutex};
+            for(std::size_t job = 0; job < jobs.size(); ++job)
+                base_stats[job] += stats.jobs[job];
+            workers[thread] = nullptr;
+            --num_running;
+        }
+        paused.notify_all();
+
+        return stats;
+    }
+
+    // wait for every running thread to stop between second row words. Threads that start running
+    // stop before claiming anything
+    void pause()
+    {
+        std::unique_lock lock{pause_mutex};
+        pause_requested = true;
+        paused.wait(lock, [this]{ return num_paused == num_running; });
+    }
+
+    void resume()
+    {
+        {
+            std::scoped_lock lock{pause_mutex};
+            pause_requested = false;
+        }
+        resumed.notify_all();
+    }
+
+    // where the search is up to. Only call while paused, or once no threads are running
+    Snapshot snapshot() const
+    {
+        std::scoped_lock lock{pause_mutex};
+
+        Snapshot snapshot;
+        snapshot.tasks.resize(tasks.size());
+        auto claimed = std::min(next_task.load(std::memory_order_relaxed), tasks.size());
+        for(std::size_t t = 0; t < claimed; ++t)
+        {
+            auto size = tasks[t].size.load(std::memory_order_relaxed);
+            auto next = tasks[t].next.load(std::memory_order_relaxed);
+            snapshot.tasks[t] = next >= size ? Snapshot::finished : next;
+        }
+
+        snapshot.stats = base_stats;
+        for(const auto * worker: workers)
+        {
+            if(!worker)
+                continue;
+            for(std::size_t job = 0; job < jobs.size(); ++job)
+            {
+                if(worker->searches[job])
+                    snapshot.stats[job] += worker->searches[job]->get_stats();
+            }
+        }
+
+        return snapshot;
+    }
+
+    // these may be called from any thread while the search is running
+
+    // stop searching as soon as possible, leaving the rest of the work undone. Threads finish the word
+    // they're on and return from run
+    void cancel()
+    {
+        for(auto & job_progress: progress)
+            job_progress.stop.store(true, std::memory_order_relaxed);
+    }
+
+    // total number of top words in all jobs
+    std::size_t num_tasks() const { return tasks.size(); }
+
+    // top words that have been completely searched
+    std::size_t tasks_finished() const { return num_finished.load(std::memory_order_relaxed); }
+
+    // tasks restore found nothing left to do in, which tasks_finished() counts as run skips them
+    std::size_t tasks_resumed() const { return num_resumed; }
+
+    // when the job's first grid was found, if it has a limit and one has been
+    std::optional<std::chrono::steady_clock::time_point> first_grid_time(const std::size_t job) const
+    {
+        auto time = progress[job].first_grid.load(std::memory_order_relaxed);
+        if(time == 0)
+            return std::nullopt;
+        return std::chrono::steady_clock::time_point{std::chrono::steady_clock::duration{time}};
+    }
+
+    // nodes searched so far. Each thread updates its count after every second row, so this lags a little
+    std::size_t nodes() const
+    {
+        std::size_t total = 0;
+        for(const auto & n: thread_nodes)
+            total += n.nodes.load(std::memory_order_relaxed);
+        return total;
+    }
+
+private:
+    struct Task
+    {
+        static constexpr std::uint32_t unset = std::numeric_limits<std::uint32_t>::max();
+
+        std::atomic<std::uint32_t> next{0};    // next second row word to claim
+        std::atomic<std::uint32_t> size{unset}; // number of second row words, once the first claimant has listed them
+        std::atomic<std::uint32_t> done{0};    // second row words that have been searched
+
+        std::uint32_t remaining() const
+        {
+            auto s = size.load(std::memory_order_acquire);
+            if(s == unset)
+                return 0;
+            auto n = next.load(std::memory_order_relaxed);
+            return n < s ? s - n : 0;
+        }
+    };
+
+    // one running thread's state
+    struct Worker
+    {
+        Worker(Output_writer & writer, const std::size_t num_jobs):
+            output{writer},
+            searches(num_jobs)
+        {}
+
+        Output_writer::Buffer output;
+        std::vector<std::unique_ptr<Search_engine>> searches; // for each job, created when this thread first works on that job
+    };
+
+    // find which job a task belongs to, and which of that job's top words it is
+    std::pair<std::size_t, std::uint32_t> get_job(const std::size_t task) const
+    {
+        auto job = static_cast<std::size_t>(std::upper_bound(job_starts.begin(), job_starts.end(), task) - job_starts.begin()) - 1;
+        return {job, jobs[job].top_words[task - job_starts[job]]};
+    }
+
+    // search must have task's top word set. Adds the nodes searched to nodes
+    void run_second_rows(Search_engine & search, Task & task, const Search_job & job, const Job_progress & job_progress, Worker & worker,
+            std::atomic<std::size_t> & nodes)
+    {
+        const auto size = task.size.load(std::memory_order_acquire);
+        while(true)
+        {
+            // checked before claiming, so that paused threads have finished everything they've claimed
+            if(pause_requested.load(std::memory_order_relaxed))
+                pause_point(worker);
+
+            auto i = task.next.fetch_add(1, std::memory_order_relaxed);
+            if(i >= size)
+                return;
+
+            if(job_progress.stop.load(std::memory_order_relaxed))
+                return;
+
+            if(!track_progress && !job.random_seed)
+            {
+                search.search_second_row(i);
+                continue;
+            }
+
+            auto nodes_before = search.get_stats().nodes();
+            auto grids_before = search.get_stats().grids();
+            search.search_second_row(i);
+
+            std::uint32_t searched = 1;
+
+            // when sampling, leave the top row after its first grid too, so each grid comes from a different
+            // one. Claiming the rest of its second rows stops any other thread on it as well
+            if(job.random_seed && search.get_stats().grids() != grids_before)
+            {
+                auto rest = task.next.exchange(size, std::memory_order_relaxed);
+                if(rest < size)
+                    searched += size - rest;
+            }
+
+            if(!track_progress)
+                continue;
+
+            // only this thread writes its count, so there's no need for an atomic add
+            nodes.store(nodes.load(std::memory_order_relaxed) + search.get_stats().nodes() - nodes_before, std::memory_order_relaxed);
+
+            if(task.done.fetch_add(searched, std::memory_order_relaxed) + searched == size)
+                num_finished.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // wait here until resumed
+    void pause_point(Worker & worker)
+    {
+        worker.output.flush();
+
+        std::unique_lock lock{pause_mutex};
+        ++num_paused;
+        paused.notify_all();
+        resumed.wait(lock, [this]{ return !pause_requested.load(std::memory_order_relaxed); });
+        --num_paused;
+    }
+
+    // nodes searched by one thread, on its own cache line so updating it doesn't slow down the others
+    struct alignas(cache_line_size) Thread_nodes
+    {
+        std::atomic<std::size_t> nodes{0};
+    };
+
+    const std::vector<Search_job> & jobs;
+    Output_writer & writer;
+    const bool track_progress;
+    std::vector<Job_progress> progress;
+    std::vector<std::size_t> job_starts; // index of each job's first top word in tasks
+    std::vector<Task> tasks;
+    std::atomic<std::size_t> next_task{0};
+    std::atomic<std::size_t> num_published{0};
+    std::atomic<std::size_t> num_finished{0};
+    std::size_t num_resumed = 0;
+    std::vector<Thread_nodes> thread_nodes;
+
+    std::vector<std::uint32_t> resume_from; // progress from an earlier run for each task, if restored
+
+    // for pausing. The rest are guarded by pause_mutex
+    std::atomic<bool> pause_requested{false};
+    mutable std::mutex pause_mutex;
+    std::condition_variable paused;  // signals pause() when a thread pauses or exits
+    std::condition_variable resumed; // signals paused threads to continue
+    std::size_t num_running = 0;
+    std::size_t num_paused = 0;
+    std::vector<Worker *> workers;        // each running thread's state, by thread number
+    std::vector<Search_stats> base_stats; // stats for each job from earlier runs and threads that have exited
+};
+
+// reads and writes checkpoint files, which record a Work_queue::Snapshot along with enough about the
+// search it came from to make sure it's only resumed by the same search. Like the index, they're
+// written in native byte order
+class Checkpoint_file
+{
+public:
+    // write to a temporary file, then replace filename with it, so there's always a complete checkpoint to resume from
+    static bool write(const std::string & filename, const std::vector<Search_job> & jobs, const Work_queue::Snapshot & snapshot)
+    {
+        const auto tmp_filename = filename + ".tmp";
+        auto file = std::fopen(tmp_filename.c_str(), "wb");
+        if(!file)
+        {
+            std::cerr<<"Error opening "<<tmp_filename<<": "<<std::strerror(errno)<<std::endl;
+            return false;
+        }
+
+        auto header = describe(jobs, snapshot.tasks.size());
+        auto ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+        for(std::size_t job = 0; job < jobs.size() && ok; ++job)
+        {
+            auto job_header = describe(jobs[job]);
+            ok = std::fwrite(&job_header, sizeof(job_header), 1, file) == 1
+                && std::fwrite(&snapshot.stats[job], sizeof(Search_stats), 1, file) == 1;
+        }
+        ok = ok && std::fwrite(snapshot.tasks.data(), sizeof(std::uint32_t), snapshot.tasks.size(), file) == snapshot.tasks.size();
+
+        // make sure it's on disk before it replaces the last one
+        ok = ok && std::fflush(file) == 0 && fsync(fileno(file)) == 0;
+        if(std::fclose(file) != 0)
+            ok = false;
+
+        if(!ok || std::rename(tmp_filename.c_str(), filename.c_str()) != 0)
+        {
+            std::cerr<<"Error writing "<<filename<<": "<<std::strerror(errno)<<std::endl;
+            std::remove(tmp_filename.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    // read a checkpoint of the given jobs. Returns an empty snapshot if there isn't one yet
+    static std::optional<Work_queue::Snapshot> read(const std::string & filename, const std::vector<Search_job> & jobs, const std::size_t num_tasks)
+    {
+        Work_queue::Snapshot snapshot;
+
+        auto file = std::fopen(filename.c_str(), "rb");
+        if(!file)
+        {
+            if(errno == ENOENT)
+                return std::make_optional(snapshot);
+
+            std::cerr<<"Error opening "<<filename<<": "<<std::strerror(errno)<<std::endl;
+            return std::nullopt;
+        }
+
+        auto expected = describe(jobs, num_tasks);
+        Header header;
+        auto ok = std::fread(&header, sizeof(header), 1, file) == 1;
+        if(ok && (header.magic != expected.magic || header.byte_order != checkpoint_byte_order || header.version != checkpoint_version
+                    || header.alphabet_len != ALPHABET_LEN))
+        {
+            std::cerr<<filename<<" is not a word_grid checkpoint, or was written by a different version or machine"<<std::endl;
+            std::fclose(file);
+            return std::nullopt;
+        }
+
+        auto matches = ok && header.flags == expected.flags && header.num_jobs == expected.num_jobs && header.num_tasks == expected.num_tasks;
+
+        snapshot.stats.resize(jobs.size());
+        for(std::size_t job = 0; job < jobs.size() && ok && matches; ++job)
+        {
+            Job job_header;
+            ok = std::fread(&job_header, sizeof(job_header), 1, file) == 1
+                && std::fread(&snapshot.stats[job], sizeof(Search_stats), 1, file) == 1;
+
+            auto expected_job = describe(jobs[job]);
+            matches = job_header.width == expected_job.width && job_header.height == expected_job.height
+                && job_header.num_top_words == expected_job.num_top_words && job_header.words_hash == expected_job.words_hash;
+        }
+
+        if(ok && matches)
+        {
+            snapshot.tasks.resize(num_tasks);
+            ok = std::fread(snapshot.tasks.data(), sizeof(std::uint32_t), num_tasks, file) == num_tasks;
+        }
+        std::fclose(file);
+
+        if(!ok)
+        {
+            std::cerr<<"Error reading "<<filename<<": file is truncated"<<std::endl;
+            return std::nullopt;
+        }
+        if(!matches)
+        {
+            std::cerr<<filename<<" is a checkpoint of a different search. Sizes, dictionary, and options must be the same"<<std::endl;
+            return std::nullopt;
+        }
+
+        return std::make_optional(snapshot);
+    }
+
+private:
+    static constexpr char checkpoint_magic[8] = {'W', 'G', 'R', 'I', 'D', 'C', 'K', 'P'};
+    static constexpr std::uint32_t checkpoint_byte_order = 0x01020304;
+    static constexpr std::uint32_t checkpoint_version = 2;
+
+    static constexpr std::uint32_t checkpoint_canonical = 1 << 0;
+    static constexpr std::uint32_t checkpoint_adaptive = 1 << 1; // second row progress means something different in each engine
+    static constexpr std::uint32_t checkpoint_rare_first = 1 << 2; // and with each second row order
+    static constexpr std::uint32_t checkpoint_dlx = 1 << 3;
+
+    struct Header
+    {
+        std::array<char, sizeof(checkpoint_magic)> magic{};
+        std::uint32_t byte_order = checkpoint_byte_order;
+        std::uint32_t version = checkpoint_version;
+        std::uint32_t alphabet_len = ALPHABET_LEN;
+        std::uint32_t flags = 0;
+        std::uint64_t num_jobs = 0;
+        std::uint64_t num_tasks = 0;
+    };
+
+    // followed by the job's Search_stats
+    struct Job
+    {
+        std::uint32_t width = 0;
+        std::uint32_t height = 0;
+        std::uint64_t num_top_words = 0;
+        std::uint64_t words_hash = 0; // of the word lists and top words, to catch resuming with a different dictionary or shard
+    };
+
+    static_assert(std::is_trivially_copyable_v<Search_stats>);
+
+    static Job describe(const Search_job & search_job)
+    {
+        Job job;
+        job.width = search_job.width;
+        job.height = search_job.height;
+        job.num_top_words = search_job.top_words.size();
+        job.words_hash = hash_bytes(search_job.top_words.data(), search_job.top_words.size() * sizeof(std::uint32_t));
+        job.words_hash = hash_bytes(search_job.row_words->letters.data, search_job.row_words->letters.size, job.words_hash);
+        job.words_hash = hash_bytes(search_job.col_prefixes->nodes.data, search_job.col_prefixes->nodes.size * sizeof(Prefix_trie::Node), job.words_hash);
+        return job;
+    }
+
+    static Header describe(const std::vector<Search_job> & jobs, const std::size_t num_tasks)
+    {
+        Header header;
+        std::copy(std::begin(checkpoint_magic), std::end(checkpoint_magic), header.magic.begin());
+        header.flags = (!jobs.empty() && jobs.front().canonical ? checkpoint_canonical : 0)
+            | (!jobs.empty() && jobs.front().engine == Engine::adaptive ? checkpoint_adaptive : 0)
+            | (!jobs.empty() && jobs.front().rare_first ? checkpoint_rare_first : 0)
+            | (!jobs.empty() && jobs.front().engine == Engine::dlx ? checkpoint_dlx : 0);
+        header.num_jobs = jobs.size();
+        header.num_tasks = num_tasks;
+        return header;
+    }
+};
+
+// write a checkpoint every interval, until stop is called. The search threads are
+// paused while the checkpoint is taken, and any grids they've found are written out first
+class Checkpointer
+{
+public:
+    Checkpointer(Work_queue & queue, Output_writer & writer, const std::vector<Search_job> & jobs,
+            const std::string & filename, const std::chrono::seconds interval):
+        queue{queue},
+        writer{writer},
+        jobs{jobs},
+        filename{filename},
+        interval{interval},
+        thread{&Checkpointer::run, this}
+    {}
+
+    ~Checkpointer() { stop(); }
+
+    void stop()
+    {
+        {
+            std::scoped_lock lock{mutex};
+            done = true;
+        }
+        wake.notify_one();
+
+        if(thread.joinable())
+            thread.join();
+    }
+
+private:
+    void run()
+    {
+        std::unique_lock lock{mutex};
+        while(!wake.wait_for(lock, interval, [this]{ return done; }))
+        {
+            queue.pause();
+            writer.sync();
+            auto snapshot = queue.snapshot();
+            queue.resume();
+
+            Checkpoint_file::write(filename, jobs, snapshot);
+        }
+    }
+
+    Work_queue & queue;
+    Output_writer & writer;
+    const std::vector<Search_job> & jobs;
+    const std::string filename;
+    const std::chrono::seconds interval;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool done = false;
+
+    std::thread thread; // started last, once everything it uses is set up
+};
+
+// print how far along the search is to stderr every interval, until stop is called. Only reads
+// the queue's atomic counters, so the search threads are never held up
+class Progress_reporter
+{
+public:
+    Progress_reporter(const Work_queue & queue, const std::chrono::seconds interval):
+        queue{queue},
+        interval{interval},
+        terminal{isatty(STDERR_FILENO) != 0},
+        thread{&Progress_reporter::run, this}
+    {}
+
+    ~Progress_reporter() { stop(); }
+
+    void stop()
+    {
+        {
+            std::scoped_lock lock{mutex};
+            done = true;
+        }
+        wake.notify_one();
+
+        if(thread.joinable())
+            thread.join();
+    }
+
+private:
+    void run()
+    {
+        // tasks skipped by --resume count as finished, but take none of this run's time
+        const auto start = std::chrono::steady_clock::now();
+        const auto start_finished = queue.tasks_resumed();
+        auto last_time = start;
+        auto last_nodes = queue.nodes();
+
+        std::unique_lock lock{mutex};
+        while(!wake.wait_for(lock, interval, [this]{ return done; }))
+        {
+            auto now = std::chrono::steady_clock::now();
+            auto nodes = queue.nodes();
+            auto finished = queue.tasks_finished();
+            auto total = queue.num_tasks();
+
+            auto seconds = std::chrono::duration<double>(now - last_time).count();
+            auto nodes_per_second = seconds > 0.0 ? (nodes - last_nodes) / seconds : 0.0;
+            last_time = now;
+            last_nodes = nodes;
+
+            std::ostringstream line;
+            line<<"top words: "<<finished<<" / "<<total
+                <<std::fixed<<std::setprecision(1)<<" ("<<(total ? 100.0 * finished / total : 100.0)<<"%), "
+                <<std::setprecision(0)<<nodes_per_second<<" nodes/s, ETA: ";
+
+            // assumes the top words left take as long on average as the ones this run has done so far
+            if(finished > start_finished)
+            {
+                auto elapsed = std::chrono::duration<double>(now - start).count();
+                line<<format_duration(elapsed * (total - finished) / (finished - start_finished));
+            }
+            else
+                line<<"unknown";
+
+            // on a terminal, keep overwriting the same line
+            if(terminal)
+                std::cerr<<"\r"<<line.str()<<"\033[K"<<std::flush;
+            else
+                std::cerr<<line.str()<<std::endl;
+        }
+
+        if(terminal)
+            std::cerr<<"\r\033[K"<<std::flush;
+    }
+
+    static std::string format_duration(const double seconds)
+    {
+        auto total = static_cast<std::uint64_t>(seconds + 0.5);
+        std::ostringstream out;
+        if(total >= 3600)
+            out<<total / 3600<<"h";
+        if(total >= 60)
+            out<<std::setw(total >= 3600 ? 2 : 1)<<std::setfill('0')<<total / 60 % 60<<"m";
+        out<<std::setw(total >= 60 ? 2 : 1)<<std::setfill('0')<<total % 60<<"s";
+        return out.str();
+    }
+
+    const Work_queue & queue;
+    const std::chrono::seconds interval;
+    const bool terminal;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool done = false;
+
+    std::thread thread; // started last, once everything it uses is set up
+};
+
+// a fixed set of threads that run tasks in the order they're submitted
+class Thread_pool
+{
+public:
+    // each thread is pinned to the next CPU in cpus, if it isn't empty
+    Thread_pool(const std::size_t num_threads, const std::vector<int> & cpus)
+    {
+        for(std::size_t i = 0; i < num_threads; ++i)
+        {
+            threads.emplace_back([this, cpu = cpus.empty() ? -1 : cpus[i % cpus.size()]]
+            {
+                if(cpu >= 0)
+                    pin_thread(cpu);
+                run();
+            });
+        }
+    }
+
+    Thread_pool(const Thread_pool &) = delete;
+    Thread_pool & operator=(const Thread_pool &) = delete;
+
+    // finish every task already submitted, then stop the threads
+    ~Thread_pool()
+    {
+        {
+            std::scoped_lock lock{mutex};
+            done = true;
+        }
+        ready.notify_all();
+
+        for(auto & t: threads)
+            t.join();
+    }
+
+    void submit(std::function<void()> task)
+    {
+        {
+            std::scoped_lock lock{mutex};
+            tasks.push_back(std::move(task));
+        }
+        ready.notify_one();
+    }
+
+    std::size_t size() const { return threads.size(); }
+
+private:
+    void run()
+    {
+        std::unique_lock lock{mutex};
+        while(true)
+        {
+            ready.wait(lock, [this]{ return !tasks.empty() || done; });
+            if(tasks.empty())
+                break;
+
+            auto task = std::move(tasks.front());
+            tasks.pop_front();
+
+            lock.unlock();
+            task();
+            lock.lock();
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable ready; // signals the threads that there are tasks, or that we're done
+    std::deque<std::function<void()>> tasks;
+    bool done = false;
+
+    std::vector<std::thread> threads;
+};
+
+// replies to recent requests, dropping the least recently used once they take up more than max_bytes
+class Reply_cache
+{
+public:
+    using Reply = std::shared_ptr<const std::string>;
+
+    explicit Reply_cache(const std::size_t max_bytes):
+        max_bytes{max_bytes}
+    {}
+
+    Reply get(const std::string & request)
+    {
+        std::scoped_lock lock{mutex};
+
+        auto found = index.find(request);
+        if(found == index.end())
+            return nullptr;
+
+        entries.splice(entries.begin(), entries, found->second);
+        return found->second->second;
+    }
+
+    void put(const std::string & request, Reply reply)
+    {
+        // a reply that would push out most of the rest isn't worth keeping
+        const auto size = request.size() + reply->size();
+        if(size > max_bytes / 8)
+            return;
+
+        std::scoped_lock lock{mutex};
+
+        if(auto found = index.find(request); found != index.end())
+        {
+            bytes -= found->first.size() + found->second->second->size();
+            entries.erase(found->second);
+            index.erase(found);
+        }
+
+        entries.emplace_front(request, std::move(reply));
+        index.emplace(request, entries.begin());
+        bytes += size;
+
+        while(bytes > max_bytes)
+        {
+            const auto & [oldest_request, oldest_reply] = entries.back();
+            bytes -= oldest_request.size() + oldest_reply->size();
+            index.erase(oldest_request);
+            entries.pop_back();
+        }
+    }
+
+private:
+    const std::size_t max_bytes;
+
+    std::mutex mutex;
+    std::list<std::pair<std::string, Reply>> entries; // most recently used first
+    std::unordered_map<std::string, decltype(entries)::iterator> index;
+    std::size_t bytes = 0;
+};
+
+// answers grid requests on a socket, one line per request, with the dictionary loaded once up front.
+// Each connection gets its own thread to read requests and send replies, up to max_connections at once,
+// with any more left waiting to be accepted. The searches themselves run on the shared pool. A search gets an even share of the pool between the searches running when it
+// starts, and may use more as other searches finish and free up their threads
+class Server
+{
+public:
+    static constexpr std::size_t max_request_size = 1024;
+    static constexpr std::size_t cache_size = 64 << 20;
+    static constexpr std::chrono::milliseconds default_timeout{10000};
+    static constexpr std::size_t max_connections = 256;
+    static constexpr std::chrono::milliseconds accept_retry_delay{100};
+
+    Server(const Args & args, const Dictionary & dictionary, const Filter_function filter, Thread_pool & pool):
+        args{args},
+        dictionary{dictionary},
+        filter{filter},
+        pool{pool},
+        cache{cache_size}
+    {}
+
+    // listen on address and answer requests until killed. Returns false if the socket can't be set up
+    bool run(const std::string & address)
+    {
+        auto listen_fd = open_socket(address);
+        if(!listen_fd)
+            return false;
+
+        std::cerr<<"Listening on "<<address<<std::endl;
+        auto accept_failing = false;
+        while(true)
+        {
+            {
+                std::unique_lock lock{connections_mutex};
+                connection_closed.wait(lock, [this]{ return num_connections < max_connections; });
+            }
+
+            auto fd = accept(*listen_fd, nullptr, nullptr);
+            if(fd < 0)
+            {
+                if(errno == EINTR || errno == ECONNABORTED)
+                    continue;
+
+                // mostly EMFILE or ENFILE, which last until connections close, so report it
+                // once, and wait instead of retrying straight away
+                if(!accept_failing)
+                    std::cerr<<"Error accepting connection: "<<std::strerror(errno)<<std::endl;
+                accept_failing = true;
+                std::this_thread::sleep_for(accept_retry_delay);
+                continue;
+            }
+            accept_failing = false;
+
+            // replies are written in one go, so don't hold the last packet back
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+            {
+                std::scoped_lock lock{connections_mutex};
+                ++num_connections;
+            }
+            try
+            {
+                std::thread{[this, fd]
+                {
+                    serve_connection(fd);
+                    close_connection();
+                }}.detach();
+            }
+            catch(std::system_error & e)
+            {
+                std::cerr<<"Error starting connection thread: "<<e.what()<<std::endl;
+                close(fd);
+                close_connection();
+                std::this_thread::sleep_for(accept_retry_delay);
+            }
+        }
+    }
+
+private:
+    struct Request
+    {
+        int width = 0;
+        int height = 0;
+        std::uint64_t limit = 0;
+        std::optional<std::uint64_t> seed;
+        std::chrono::milliseconds timeout = default_timeout;
+        bool count_only = false;
+
+        // the request in a standard form, leaving out the timeout, since complete replies don't depend on it
+        std::string key() const
+        {
+            return std::to_string(width) + " " + std::to_string(height) + " " + std::to_string(limit)
+                + " " + (seed ? std::to_string(*seed) : "-") + (count_only ? " count" : "");
+        }
+    };
+
+    // a Unix socket if address has a '/', otherwise TCP on [HOST:]PORT
+    static std::optional<int> open_socket(const std::string & address)
+    {
+        int fd = -1;
+        if(address.find('/') != std::string::npos)
+        {
+            sockaddr_un addr{};
+            addr.sun_family = AF_UNIX;
+            if(address.size() >= sizeof(addr.sun_path))
+            {
+                std::cerr<<"Socket path is too long: "<<address<<std::endl;
+                return std::nullopt;
+            }
+            std::copy(address.begin(), address.end(), addr.sun_path);
+
+            // replace a socket left by an earlier server, but nothing else
+            struct stat file_stat;
+            if(stat(address.c_str(), &file_stat) == 0 && S_ISSOCK(file_stat.st_mode))
+                unlink(address.c_str());
+
+            fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if(fd < 0 || bind(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) < 0)
+            {
+                std::cerr<<"Error binding "<<address<<": "<<std::strerror(errno)<<std::endl;
+                if(fd >= 0)
+                    close(fd);
+                return std::nullopt;
+            }
+        }
+        else
+        {
+            std::string host, port = address;
+            if(auto colon = address.rfind(':'); colon != std::string::npos)
+            {
+                host = address.substr(0, colon);
+                port = address.substr(colon + 1);
+                if(host.size() >= 2 && host.front() == '[' && host.back() == ']')
+                    host = host.substr(1, host.size() - 2);
+            }
+
+            addrinfo hints{};
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            hints.ai_flags = AI_PASSIVE;
+
+            addrinfo * addrs = nullptr;
+            if(auto err = getaddrinfo(host.empty() ? "127.0.0.1" : host.c_str(), port.c_str(), &hints, &addrs); err != 0)
+            {
+                std::cerr<<"Invalid address "<<address<<": "<<gai_strerror(err)<<std::endl;
+                return std::nullopt;
+            }
+
+            for(auto a = addrs; a && fd < 0; a = a->ai_next)
+            {
+                fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+                if(fd < 0)
+                    continue;
+
+                int on = 1;
+                setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+                if(bind(fd, a->ai_addr, a->ai_addrlen) < 0)
+                {
+                    close(fd);
+                    fd = -1;
+                }
+            }
+            auto err = errno;
+            freeaddrinfo(addrs);
+
+            if(fd < 0)
+            {
+                std::cerr<<"Error binding "<<address<<": "<<std::strerror(err)<<std::endl;
+                return std::nullopt;
+            }
+        }
+
+        if(listen(fd, SOMAXCONN) < 0)
+        {
+            std::cerr<<"Error listening on "<<address<<": "<<std::strerror(errno)<<std::endl;
+            close(fd);
+            return std::nullopt;
+        }
+
+        return fd;
+    }
+
+    // answer each line read from fd until the other end closes it
+    void serve_connection(const int fd)
+    {
+        std::string pending;
+        std::array<char, 4096> buffer;
+        while(true)
+        {
+            auto size = recv(fd, buffer.data(), buffer.size(), 0);
+            if(size < 0 && errno == EINTR)
+                continue;
+            if(size <= 0)
+                break;
+            pending.append(buffer.data(), size);
+
+            std::size_t line_start = 0;
+            auto ok = true;
+            for(auto line_end = pending.find('\n'); ok && line_end != std::string::npos; line_end = pending.find('\n', line_start))
+            {
+                auto line = pending.substr(line_start, line_end - line_start);
+                line_start = line_end + 1;
+
+                if(!line.empty() && line.back() == '\r')
+                    line.pop_back();
+                if(line.find_first_not_of(" \t") == std::string::npos)
+                    continue;
+
+                auto reply = answer(line);
+                ok = send_all(fd, reply->data(), reply->size());
+            }
+            pending.erase(0, line_start);
+
+            if(!ok)
+                break;
+            if(pending.size() > max_request_size)
+            {
+                const std::string reply = "error: request too long\n";
+                send_all(fd, reply.data(), reply.size());
+                break;
+            }
+        }
+        close(fd);
+    }
+
+    // note that a connection's thread is done, so another can be accepted
+    void close_connection()
+    {
+        {
+            std::scoped_lock lock{connections_mutex};
+            --num_connections;
+        }
+        connection_closed.notify_one();
+    }
+
+    static bool send_all(const int fd, const char * data, std::size_t size)
+    {
+        while(size > 0)
+        {
+            auto sent = send(fd, data, size, MSG_NOSIGNAL);
+            if(sent < 0)
+            {
+                if(errno == EINTR)
+                    continue;
+                return false;
+            }
+            data += sent;
+            size -= sent;
+        }
+        return true;
+    }
+
+    Reply_cache::Reply answer(const std::string & line)
+    {
+        std::string error;
+        auto request = parse_request(line, error);
+        if(!request)
+            return std::make_shared<const std::string>("error: " + error + "\n");
+
+        auto key = request->key();
+        if(auto reply = cache.get(key))
+            return reply;
+
+        auto [reply, complete] = search(*request);
+        if(complete)
+            cache.put(key, reply);
+        return reply;
+    }
+
+    std::optional<Request> parse_request(const std::string & line, std::string & error) const
+    {
+        Request request;
+        request.limit = args.limit;
+        request.count_only = args.count_only;
+
+        // parse all of text as a number, or return nullopt
+        auto to_number = [](const std::string & text) -> std::optional<std::uint64_t>
+        {
+            if(text.empty() || text.find_first_not_of("0123456789") != std::string::npos)
+                return std::nullopt;
+            try
+            {
+                return std::stoull(text);
+            }
+            catch(std::out_of_range & e)
+            {
+                return std::nullopt;
+            }
+        };
+
+        std::istringstream words{line};
+        std::string width, height;
+        words>>width>>height;
+        auto w = to_number(width);
+        auto h = to_number(height);
+        const auto num_letters = dictionary.get_alphabet().size();
+        if(!w || !h || *w == 0 || *h == 0 || *w > num_letters || *h > num_letters || *w * *h > num_letters)
+        {
+            error = u8"expected WIDTH HEIGHT, with WIDTH × HEIGHT ≤ " + std::to_string(num_letters);
+            return std::nullopt;
+        }
+        request.width = *w;
+        request.height = *h;
+
+        for(std::string word; words>>word;)
+        {
+            if(word == "count")
+            {
+                request.count_only = true;
+                continue;
+            }
+
+            auto equals = word.find('=');
+            auto name = word.substr(0, equals);
+            auto value = equals == std::string::npos ? std::nullopt : to_number(word.substr(equals + 1));
+            if(!value)
+            {
+                error = "invalid option: " + word;
+                return std::nullopt;
+            }
+
+            if(name == "limit")
+                request.limit = *value;
+            else if(name == "seed")
+                request.seed = *value;
+            else if(name == "timeout" && *value > 0 && *value <= static_cast<std::uint64_t>(std::numeric_limits<int>::max()))
+                request.timeout = std::chrono::milliseconds{*value};
+            else
+            {
+                error = "invalid option: " + word;
+                return std::nullopt;
+            }
+        }
+
+        return request;
+    }
+
+    // run the search on the pool, and return the reply, and whether the search finished before the deadline
+    std::pair<Reply_cache::Reply, bool> search(const Request & request)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + request.timeout;
+
+        const auto & row_words = dictionary.get_words(request.width);
+        std::vector<std::uint32_t> top_words(row_words.size());
+        std::iota(top_words.begin(), top_words.end(), 0);
+
+        std::vector<Search_job> jobs{{request.width, request.height, &row_words, &dictionary.get_words(request.height).prefixes,
+                args.canonical, request.count_only, request.limit, filter, std::move(top_words),
+                get_engine(args.engine)}};
+        jobs[0].alphabet = dictionary.get_alphabet().is_plain() ? nullptr : &dictionary.get_alphabet();
+
+        // the adaptive search only shuffles its top words
+        if(request.seed)
+            randomize_job(jobs[0], *request.seed);
+        else if(args.rare_first)
+        {
+            sort_rare_first(row_words, jobs[0].top_words);
+            jobs[0].rare_first = true;
+        }
+
+        // shared with the pool tasks, which may only start after this search is over
+        struct Helpers
+        {
+            std::mutex mutex;
+            std::condition_variable changed;
+            std::size_t running = 0;
+            std::size_t finished = 0;
+            std::uint64_t grids = 0;
+            bool closed = false; // set once the search is over, so tasks that haven't started yet don't
+        };
+        auto helpers = std::make_shared<Helpers>();
+
+        const auto num_searches = ++searches_running;
+        const auto num_threads = std::max<std::size_t>(1, pool.size() / num_searches);
+
+        char * text = nullptr;
+        std::size_t text_size = 0;
+        auto file = open_memstream(&text, &text_size);
+        if(!file)
+        {
+            --searches_running;
+            return {std::make_shared<const std::string>(std::string{"error: "} + std::strerror(errno) + "\n"), false};
+        }
+
+        auto timed_out = false;
+        {
+            Output_writer writer(file, false);
+            Work_queue queue(jobs, writer, num_threads, false);
+
+            for(std::size_t i = 0; i < num_threads; ++i)
+            {
+                pool.submit([helpers, &queue, i]
+                {
+                    {
+                        std::scoped_lock lock{helpers->mutex};
+                        if(helpers->closed)
+                            return;
+                        ++helpers->running;
+                    }
+
+                    auto stats = queue.run(i);
+
+                    {
+                        std::scoped_lock lock{helpers->mutex};
+                        helpers->grids += stats.jobs[0].grids();
+                        --helpers->running;
+                        ++helpers->finished;
+                    }
+                    helpers->changed.notify_all();
+                });
+            }
+
+            // the search is done once any thread has run out of work, and the rest have caught up
+            std::unique_lock lock{helpers->mutex};
+            timed_out = !helpers->changed.wait_until(lock, deadline, [&helpers]{ return helpers->finished > 0 && helpers->running == 0; });
+            helpers->closed = true;
+            if(timed_out)
+            {
+                queue.cancel();
+                helpers->changed.wait(lock, [&helpers]{ return helpers->running == 0; });
+            }
+        }
+        --searches_running;
+
+        std::fclose(file);
+        std::string reply{text, text_size};
+        std::free(text);
+
+        reply += (timed_out ? "timeout " : "ok ") + std::to_string(helpers->grids) + "\n";
+        return {std::make_shared<const std::string>(std::move(reply)), !timed_out};
+    }
+
+    const Args & args;
+    const Dictionary & dictionary;
+    const Filter_function filter;
+    Thread_pool & pool;
+
+    Reply_cache cache;
+    std::atomic<std::size_t> searches_running{0};
+
+    std::mutex connections_mutex;
+    std::condition_variable connection_closed;
+    std::size_t num_connections = 0; // connection threads running
+};
+
+int main(int argc, char ** argv)
+{
+    auto args = parse_arguments(argc, argv);
+    if(!args)
+        return EXIT_FAILURE;
+
+    if(!args->build_index_filename.empty())
+    {
+        std::vector<std::size_t> lengths(ALPHABET_LEN + 1);
+        std::iota(lengths.begin(), lengths.end(), 0);
+
+        auto dictionary = get_word_lists(*args, args->alphabet, lengths);
+        if(!dictionary || !dictionary->write_index(args->build_index_filename))
+            return EXIT_FAILURE;
+
+        return EXIT_SUCCESS;
+    }
+
+    std::optional<Dictionary> dictionary;
+    if(args->index_filename.empty() && !args->serve_address.empty())
+    {
+        // requests may be for any size
+        std::vector<std::size_t> lengths(ALPHABET_LEN);
+        std::iota(lengths.begin(), lengths.end(), 1);
+
+        dictionary = get_word_lists(*args, args->alphabet, lengths);
+    }
+    else if(args->index_filename.empty())
+    {
+        // each length is only read once, no matter how many sizes use it
+        std::vector<std::size_t> lengths;
+        for(const auto & size: args->sizes)
+        {
+            lengths.push_back(size.width);
+            lengths.push_back(size.height);
+        }
+        std::sort(lengths.begin(), lengths.end());
+        lengths.erase(std::unique(lengths.begin(), lengths.end()), lengths.end());
+
+        dictionary = get_word_lists(*args, args->alphabet, lengths);
+    }
+    else
+    {
+        dictionary = Dictionary::load_index(args->index_filename, args->alphabet);
+        if(dictionary && (dictionary->get_use_apostrophe() != args->use_apostrophe
+                    || dictionary->get_restrict_small_words() != args->restrict_small_words))
+        {
+            std::cerr<<args->index_filename<<" was built with different -n / -s options"<<std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if(!dictionary)
+        return EXIT_FAILURE;
+
+    auto filter = get_filter(args->simd);
+    if(!filter)
+    {
+        std::cerr<<args->simd<<" filtering is not supported on this CPU"<<std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<int> cpus;
+    if(args->pin_threads)
+        cpus = args->pin_cpus.empty() ? get_allowed_cpus() : args->pin_cpus;
+
+    std::size_t num_threads = args->num_threads;
+    if(num_threads == 0)
+        num_threads = !cpus.empty() ? cpus.size() : std::max(1u, std::thread::hardware_concurrency());
+
+    if(!args->serve_address.empty())
+    {
+        Thread_pool pool(num_threads, cpus);
+        Server server(*args, *dictionary, filter, pool);
+        return server.run(args->serve_address) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // W × H and H × W grids share the same per-length word lists
+    std::vector<Search_job> jobs;
+    for(const auto & size: args->sizes)
+    {
+        // every H × W grid is the transpose of a W × H one, so only search one of the two sizes
+        if(args->canonical && size.width > size.height && std::any_of(args->sizes.begin(), args->sizes.end(),
+                    [&size](const Grid_size & other) { return other.width == size.height && other.height == size.width; }))
+            continue;
+
+        const auto & row_words = dictionary->get_words(size.width);
+        const auto & col_prefixes = dictionary->get_words(size.height).prefixes;
+
+        std::vector<std::uint32_t> top_words;
+        if(args->num_shards != 0)
+        {
+            top_words = get_shard(row_words, col_prefixes, size.height, args->shard - 1, args->num_shards);
+        }
+        else if(!args->top_words.empty())
+        {
+            for(auto i: args->top_words)
+            {
+                if(static_cast<std::size_t>(i) < row_words.size())
+                    top_words.push_back(i);
+            }
+        }
+        else
+        {
+            top_words.resize(row_words.size());
+            std::iota(top_words.begin(), top_words.end(), 0);
+        }
+
+        if(args->rare_first)
+            sort_rare_first(row_words, top_words);
+
+        jobs.push_back({size.width, size.height, &row_words, &col_prefixes,
+                args->canonical, args->count_only, args->limit, filter, std::move(top_words),
+                get_engine(args->engine)});
+        jobs.back().rare_first = args->rare_first;
+        jobs.back().alphabet = dictionary->get_alphabet().is_plain() ? nullptr : &dictionary->get_alphabet();
+    }
+
+    // the seed is printed so that the run can be repeated
+    if(args->random_grids != 0)
+    {
+        auto seed = args->seed ? *args->seed : (std::uint64_t{std::random_device{}()} << 32) | std::random_device{}();
+        if(!args->seed)
+            std::cerr<<"seed: "<<seed<<std::endl;
+
+        // each size is shuffled with its own seed, so adding a size doesn't change the others
+        for(auto & job: jobs)
+        {
+            job.limit = args->random_grids;
+            randomize_job(job, seed ^ (static_cast<std::uint64_t>(job.width) << 32 | job.height));
+        }
+    }
+
+    // each size has its own words to copy to the device
+    std::vector<std::unique_ptr<Bottom_rows_solver>> offloads;
+    if(args->offload != "none")
+    {
+        for(auto & job: jobs)
+        {
+            offloads.push_back(make_bottom_rows_solver(args->offload, *job.row_words, *job.col_prefixes));
+            if(!offloads.back())
+                return EXIT_FAILURE;
+            job.offload = offloads.back().get();
+        }
+    }
+
+    const auto format = args->format == "binary" ? Output_format::binary : args->format == "jsonl" ? Output_format::jsonl : Output_format::text;
+    for(std::size_t job = 0; job < jobs.size(); ++job)
+    {
+        jobs[job].format = format;
+        if(jobs.size() > 1)
+            jobs[job].size_index = job;
+    }
+
+    std::vector<Work_queue::Thread_stats> thread_stats(num_threads);
+    Output_writer writer(stdout, num_threads > 1);
+
+    if(format == Output_format::binary)
+    {
+        Output_writer::Buffer header(writer);
+        write_binary_header(header, jobs, dictionary->get_use_apostrophe(), dictionary->get_restrict_small_words(), args->canonical);
+    }
+
+    // sizes cached by an earlier run are output from the cache instead of searched. The rest are recorded
+    // to it, unless there's a limit, since then not every grid is found
+    std::vector<std::uint64_t> cached_grids(jobs.size());
+    std::vector<std::unique_ptr<Solution_file::Recorder>> recorders(jobs.size());
+    if(!args->cache_directory.empty())
+    {
+        if(mkdir(args->cache_directory.c_str(), 0777) < 0 && errno != EEXIST)
+        {
+            std::cerr<<"Error creating "<<args->cache_directory<<": "<<std::strerror(errno)<<std::endl;
+            return EXIT_FAILURE;
+        }
+
+        Output_writer::Buffer output(writer);
+        for(std::size_t job = 0; job < jobs.size(); ++job)
+        {
+            auto & search_job = jobs[job];
+            auto key = Solution_file::make_key(*search_job.row_words, dictionary->get_words(search_job.height),
+                    dictionary->get_use_apostrophe(), dictionary->get_restrict_small_words(), search_job.canonical);
+            auto filename = Solution_file::get_filename(args->cache_directory, key);
+
+            if(auto grids = Solution_file::read(filename, key, search_job, output))
+            {
+                cached_grids[job] = *grids;
+                search_job.top_words.clear();
+            }
+            else if(search_job.limit == 0)
+            {
+                recorders[job] = std::make_unique<Solution_file::Recorder>(filename, key);
+                search_job.record = recorders[job]->get_writer();
+            }
+        }
+    }
+
+    Work_queue queue(jobs, writer, num_threads, args->progress_interval > 0);
+
+    if(args->resume)
+    {
+        auto snapshot = Checkpoint_file::read(args->checkpoint_filename, jobs, queue.num_tasks());
+        if(!snapshot)
+            return EXIT_FAILURE;
+        if(!snapshot->tasks.empty())
+            queue.restore(*snapshot);
+    }
+
+    // each worker takes work from the queue until it's all done
+    auto worker = [&cpus, &thread_stats, &queue](const std::size_t i)
+    {
+        // pin before allocating anything, so the search buffers stay local to this CPU's memory
+        if(!cpus.empty())
+            pin_thread(cpus[i % cpus.size()]);
+
+        thread_stats[i] = queue.run(i);
+    };
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::optional<Progress_reporter> progress;
+    if(args->progress_interval > 0)
+        progress.emplace(queue, std::chrono::seconds{args->progress_interval});
+
+    std::optional<Checkpointer> checkpointer;
+    if(!args->checkpoint_filename.empty())
+        checkpointer.emplace(queue, writer, jobs, args->checkpoint_filename, std::chrono::seconds{args->checkpoint_interval});
+
+    if(num_threads == 1)
+    {
+        worker(0);
+    }
+    else
+    {
+        std::vector<std::thread> thread_pool;
+        for(std::size_t i = 0; i < num_threads; ++i)
+            thread_pool.emplace_back(worker, i);
+
+        for(auto & t: thread_pool)
+            t.join();
+    }
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    if(progress)
+        progress->stop();
+    if(checkpointer)
+        checkpointer->stop();
+
+    writer.finish();
+
+    // every thread is done, so this has all of their stats, plus any from the run we resumed
+    auto final_state = queue.snapshot();
+
+    // the final checkpoint records everything as done, so resuming a finished search just prints the counts
+    if(checkpointer && !Checkpoint_file::write(args->checkpoint_filename, jobs, final_state))
+        return EXIT_FAILURE;
+
+    const auto & job_stats = final_state.stats;
+
+    if(args->random_grids != 0)
+    {
+        for(std::size_t job = 0; job < jobs.size(); ++job)
+        {
+            std::cerr<<jobs[job].width<<"x"<<jobs[job].height<<" first grid: ";
+            if(auto time = queue.first_grid_time(job))
+                std::cerr<<std::chrono::duration<double>(*time - start).count()<<" s\n";
+            else
+                std::cerr<<"none\n";
+        }
+    }
+
+    for(std::size_t job = 0; job < jobs.size(); ++job)
+    {
+        if(recorders[job] && !recorders[job]->finish(job_stats[job].grids()))
+            return EXIT_FAILURE;
+    }
+
+    if(args->count_only)
+    {
+        for(std::size_t job = 0; job < jobs.size(); ++job)
+        {
+            if(format == Output_format::jsonl)
+                std::cout<<"{\"width\":"<<jobs[job].width<<",\"height\":"<<jobs[job].height<<",\"count\":"<<job_stats[job].grids() + cached_grids[job]<<"}\n";
+            else
+                std::cout<<jobs[job].width<<"x"<<jobs[job].height<<": "<<job_stats[job].grids() + cached_grids[job]<<"\n";
+        }
+    }
+
+    if(args->print_stats)
+    {
+        Search_stats total;
+        for(const auto & stats: job_stats)
+            total += stats;
+
+        if(!count_stats)
+            std::cerr<<"word_grid was built with WORD_GRID_STATS=OFF, so only grids are counted\n";
+        std::cerr<<"nodes: "<<total.nodes()<<"\n"
+                 <<"grids: "<<total.grids()<<"\n"
+                 <<"prefix lookups: "<<total.prefix_lookups<<"\n"
+                 <<"allocations: "<<total.allocations<<"\n"
+                 <<"allocations per node: "<<(total.nodes() ? static_cast<double>(total.allocations) / total.nodes() : 0.0)<<"\n";
+
+        auto percent = [](const std::size_t part, const std::size_t whole)
+        {
+            return whole ? 100.0 * part / whole : 0.0;
+        };
+
+        // the overlap rejections for a row are the candidates that were never tried, so the rate is out of both
+        std::cerr<<"\n"<<std::setw(5)<<"row"<<std::setw(16)<<"nodes"<<std::setw(18)<<"overlap rejects"<<std::setw(10)<<"%"
+                 <<std::setw(18)<<"prefix rejects"<<std::setw(10)<<"%"<<std::setw(18)<<"forward rejects"<<std::setw(10)<<"%"
+                 <<std::setw(16)<<"grids"<<"\n";
+        std::cerr<<std::fixed<<std::setprecision(1);
+        for(std::size_t depth = 0; depth < total.depths.size(); ++depth)
+        {
+            const auto & d = total.depths[depth];
+            if(d.nodes == 0 && d.overlap_rejects == 0 && d.grids == 0)
+                continue;
+            std::cerr<<std::setw(5)<<depth + 1<<std::setw(16)<<d.nodes
+                     <<std::setw(18)<<d.overlap_rejects<<std::setw(10)<<percent(d.overlap_rejects, d.overlap_rejects + d.nodes)
+                     <<std::setw(18)<<d.prefix_rejects<<std::setw(10)<<percent(d.prefix_rejects, d.nodes)
+                     <<std::setw(18)<<d.forward_rejects<<std::setw(10)<<percent(d.forward_rejects, d.nodes)
+                     <<std::setw(16)<<d.grids<<"\n";
+        }
+
+        // idle time is time spent not searching, including after this thread ran out of work and others hadn't
+        const auto elapsed_seconds = std::chrono::duration<double>(elapsed).count();
+        std::cerr<<"\n"<<std::setw(7)<<"thread"<<std::setw(16)<<"nodes"<<std::setw(12)<<"busy (s)"<<std::setw(12)<<"idle (s)"
+                 <<std::setw(10)<<"busy %"<<"\n";
+        std::cerr<<std::setprecision(3);
+        for(std::size_t i = 0; i < thread_stats.size(); ++i)
+        {
+            std::size_t nodes = 0;
+            for(const auto & stats: thread_stats[i].jobs)
+                nodes += stats.nodes();
+
+            const auto busy_seconds = std::chrono::duration<double>(thread_stats[i].busy).count();
+            std::cerr<<std::setw(7)<<i<<std::setw(16)<<nodes<<std::setw(12)<<busy_seconds
+                     <<std::setw(12)<<std::max(0.0, elapsed_seconds - busy_seconds)
+                     <<std::setw(10)<<std::setprecision(1)<<(elapsed_seconds > 0.0 ? 100.0 * busy_seconds / elapsed_seconds : 0.0)
+                     <<std::setprecision(3)<<"\n";
+        }
+        std::cerr<<"elapsed: "<<elapsed_seconds<<" s\n";
+    }
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,792 @@
+// Copyright 2017 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// benchmark for word_grid. Runs word_grid on a fixed set of grid sizes, with
+// a generated dictionary so results are the same on every machine, and
+// reports the time, work done, and memory used for each. With --random, it
+// instead runs word_grid --random 1 with a different seed each time, and
+// reports the spread of the time it takes to find a grid. With --engines, it
+// runs each size with each search engine, and checks they all find the same
+// grids: each engine is also run once with its grids output, and the set of
+// grids, in whatever order they come out, is compared by hash
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct Args
+{
+    std::string word_grid_path;
+    std::string dictionary_filename; // empty to generate one
+    std::string json_filename;       // "-" for stdout
+    int repeat = 1;
+    int random_runs = 0;             // if not 0, time finding a random grid this many times per size instead
+    std::vector<std::string> engines; // run each size with word_grid --engine set to each of these, if not empty
+    std::vector<std::pair<int, int>> sizes;
+    std::vector<std::string> word_grid_args;
+};
+
+struct Result
+{
+    int width = 0;
+    int height = 0;
+    std::string engine;          // empty for word_grid's default
+    double seconds = 0.0;        // wall time of the fastest run
+    std::uint64_t nodes = 0;
+    std::uint64_t grids = 0;
+    std::uint64_t prefix_lookups = 0;
+    long peak_rss_kib = 0;       // largest of all the runs
+    std::uint64_t grids_hash = 0; // of the set of grids found, if run with hash_grids
+    double first_grid_seconds = -1.0; // from the start of the search, as reported by word_grid --random, or -1 if it found none
+};
+
+// latency percentiles of a size's --random runs
+struct Random_result
+{
+    int width = 0;
+    int height = 0;
+    int runs = 0;
+    int found = 0;              // runs that found a grid
+    double first_grid_p50 = 0.0; // seconds from the start of the search to the first grid, over the runs that found one
+    double first_grid_p99 = 0.0;
+    double seconds_p50 = 0.0;    // wall time of the whole run, including loading the dictionary
+    double seconds_p99 = 0.0;
+};
+
+std::optional<Args> parse_arguments(int argc, char ** argv)
+{
+    Args args;
+
+    option longopts[] =
+    {
+        {"help", no_argument, NULL, 'h'},
+        {"word-grid", required_argument, NULL, 'w'},
+        {"dictionary", required_argument, NULL, 'd'},
+        {"json", required_argument, NULL, 'j'},
+        {"repeat", required_argument, NULL, 'r'},
+        {"random", required_argument, NULL, 'R'},
+        {"engines", required_argument, NULL, 'e'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int opt = 0;
+    extern char * optarg;
+    extern int optind, optopt;
+
+    std::string prog_name = argv[0];
+    std::string prog_dir = ".";
+    auto sep_pos = prog_name.find_last_of("/");
+    if(sep_pos != std::string::npos)
+    {
+        prog_dir = prog_name.substr(0, sep_pos);
+        prog_name = prog_name.substr(sep_pos + 1);
+    }
+
+    // by default, use the word_grid built next to us
+    args.word_grid_path = prog_dir + "/word_grid";
+
+    // everything after a -- is for word_grid, so getopt never sees it
+    for(int i = 1; i < argc; ++i)
+    {
+        if(argv[i] == std::string{"--"})
+        {
+            args.word_grid_args.assign(argv + i + 1, argv + argc);
+            argc = i;
+            break;
+        }
+    }
+
+    auto usage = "usage: " + prog_name + " [-h] [-w WORD_GRID] [-d DICTIONARY] [-j JSON_FILE] [-r REPEAT | -R RUNS] [-e ENGINES]\n"
+        "       " + std::string(prog_name.size(), ' ') + " [WIDTH HEIGHT [WIDTH HEIGHT …]] [-- WORD_GRID_ARGS …]\n";
+
+    // parse all of an integer argument, which must be > 0
+    auto get_count = [](const char * text, const char * name) -> std::optional<int>
+    {
+        int count = 0;
+        try
+        {
+            std::size_t pos = 0;
+            count = std::stoi(text, &pos);
+            if(pos != std::strlen(text))
+                throw std::invalid_argument{text};
+        }
+        catch(std::logic_error & e)
+        {
+            std::cerr<<"Invalid integer for "<<name<<" argument: "<<text<<"\n";
+            return std::nullopt;
+        }
+        if(count < 1)
+        {
+            std::cerr<<"The "<<name<<" count is too small. Must be > 0\n";
+            return std::nullopt;
+        }
+        return count;
+    };
+
+    while((opt = getopt_long(argc, argv, ":hw:d:j:r:R:e:", longopts, NULL)) != -1)
+    {
+        switch(opt)
+        {
+            case 'h':
+                std::cout<<usage<<"\n";
+                std::cout<<"Runs word_grid -c --stats on each grid size, and reports how long it took\n\n"
+                         <<"Options:\n"
+                         <<"  -h, --help                   Show this message and quit\n"
+                         <<"  -w, --word-grid WORD_GRID    word_grid executable to run. Default: word_grid in the same directory as this\n"
+                         <<"  -d, --dictionary DICTIONARY  Dictionary file to use instead of the generated one\n"
+                         <<"  -j, --json JSON_FILE         Also write the results as JSON to JSON_FILE, or stdout for -\n"
+                         <<"  -r, --repeat REPEAT          Run each size REPEAT times, and report the fastest. Default: 1\n"
+                         <<"  -R, --random RUNS            Run word_grid --random 1 RUNS times per size, with seeds 1 to RUNS,\n"
+                         <<"                               and report the median and 99th percentile time to the first grid\n"
+                         <<"  -e, --engines ENGINES        Comma separated word_grid --engine values to run each size with,\n"
+                         <<"                               failing if they don't all find the same grids. Each engine is also\n"
+                         <<"                               run once untimed with its grids output, to compare them\n"
+                         <<"  WIDTH HEIGHT                 Grid sizes to run. Default: every size from 2x2 to 5x5\n"
+                         <<"  WORD_GRID_ARGS               Extra arguments for word_grid, such as -t or --simd\n";
+                return std::nullopt;
+
+            case 'w':
+                args.word_grid_path = optarg;
+                break;
+
+            case 'd':
+                args.dictionary_filename = optarg;
+                break;
+
+            case 'j':
+                args.json_filename = optarg;
+                break;
+
+            case 'r':
+            {
+                auto repeat = get_count(optarg, "repeat");
+                if(!repeat)
+                    return std::nullopt;
+                args.repeat = *repeat;
+                break;
+            }
+
+            case 'R':
+            {
+                auto runs = get_count(optarg, "random");
+                if(!runs)
+                    return std::nullopt;
+                args.random_runs = *runs;
+                break;
+            }
+
+            case 'e':
+            {
+                std::istringstream engines(optarg);
+                std::string engine;
+                while(std::getline(engines, engine, ','))
+                {
+                    if(!engine.empty())
+                        args.engines.push_back(engine);
+                }
+                break;
+            }
+
+            case ':':
+                std::cerr<<"Argument required for "<<(char)optopt<<"\n";
+                std::cerr<<usage<<"\n";
+                return std::nullopt;
+
+            case '?':
+            default:
+                std::cerr<<"Unknown option for "<<(char)optopt<<"\n";
+                std::cerr<<usage<<"\n";
+                return std::nullopt;
+        }
+    }
+
+    for(; optind < argc; optind += 2)
+    {
+        if(optind + 1 >= argc)
+        {
+            std::cerr<<"Missing height argument\n";
+            return std::nullopt;
+        }
+
+        try
+        {
+            std::size_t width_len = 0, height_len = 0;
+            auto width = std::stoi(argv[optind], &width_len);
+            auto height = std::stoi(argv[optind + 1], &height_len);
+            if(width_len != std::strlen(argv[optind]) || height_len != std::strlen(argv[optind + 1]) || width < 1 || height < 1)
+                throw std::invalid_argument{argv[optind]};
+            args.sizes.emplace_back(width, height);
+        }
+        catch(std::logic_error & e)
+        {
+            std::cerr<<"Invalid grid size: "<<argv[optind]<<" "<<argv[optind + 1]<<"\n";
+            return std::nullopt;
+        }
+    }
+
+    if(!args.engines.empty() && args.random_runs != 0)
+    {
+        std::cerr<<"--engines can't be used with --random\n";
+        return std::nullopt;
+    }
+
+    if(args.sizes.empty())
+    {
+        for(int width = 2; width <= 5; ++width)
+        {
+            for(int height = 2; height <= 5; ++height)
+                args.sizes.emplace_back(width, height);
+        }
+    }
+
+    return std::make_optional(args);
+}
+
+// write a dictionary of made up words to filename. Letters are picked about
+// as often as they are in English, and never repeat within a word, so the
+// search behaves roughly like it does on a real dictionary. The generator
+// is seeded with a constant, so the words are always the same
+bool generate_dictionary(const std::string & filename)
+{
+    // relative frequency of each letter in English text, per 1000 letters
+    const std::array<int, 26> frequencies
+    {
+        82, 15, 28, 43, 127, 22, 20, 61, 70, 2, 8, 40, 24,
+        67, 75, 19, 1, 60, 63, 91, 28, 10, 24, 2, 20, 1
+    };
+    // number of words to make for each length
+    const std::array<int, 6> counts {0, 0, 150, 600, 3000, 6000};
+
+    std::ofstream dictionary(filename);
+    if(!dictionary)
+    {
+        std::cerr<<"Error opening "<<filename<<": "<<std::strerror(errno)<<std::endl;
+        return false;
+    }
+
+    int total_frequency = 0;
+    for(auto f: frequencies)
+        total_frequency += f;
+
+    std::uint64_t state = 0x2545F4914F6CDD1D;
+    auto random = [&state](std::uint32_t max)
+    {
+        // xorshift64*
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return static_cast<std::uint32_t>(((state * 0x2545F4914F6CDD1DULL) >> 32) % max);
+    };
+
+    for(std::size_t length = 0; length < counts.size(); ++length)
+    {
+        for(int i = 0; i < counts[length]; ++i)
+        {
+            std::string word;
+            std::uint32_t used = 0;
+            while(word.size() < length)
+            {
+                auto pick = static_cast<int>(random(total_frequency));
+                int letter = 0;
+                while(pick >= frequencies[letter])
+                    pick -= frequencies[letter++];
+
+                if(used & (1u << letter))
+                    continue;
+                used |= 1u << letter;
+                word += static_cast<char>('a' + letter);
+            }
+            dictionary<<word<<"\n";
+        }
+    }
+
+    if(!dictionary)
+    {
+        std::cerr<<"Error writing "<<filename<<": "<<std::strerror(errno)<<std::endl;
+        return false;
+    }
+    return true;
+}
+
+// order independent hash of grids output as text, each followed by a blank line. Each grid's text is
+// hashed with FNV-1a, then mixed, so that adding the grids' hashes up gives a good hash of the set
+class Grid_set_hash
+{
+public:
+    void add(const char * text, const std::size_t size)
+    {
+        for(std::size_t i = 0; i < size; ++i)
+        {
+            const auto c = static_cast<unsigned char>(text[i]);
+            if(c == '\n' && last == '\n')
+            {
+                sum += mix(grid_hash);
+                ++count;
+                grid_hash = fnv_offset;
+            }
+            else
+            {
+                grid_hash ^= c;
+                grid_hash *= 0x100000001b3;
+            }
+            last = c;
+        }
+    }
+
+    std::uint64_t get() const { return sum; }
+    std::uint64_t grids() const { return count; }
+
+private:
+    static constexpr std::uint64_t fnv_offset = 0xcbf29ce484222325;
+
+    // splitmix64's finalizer
+    static std::uint64_t mix(std::uint64_t h)
+    {
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111eb;
+        return h ^ (h >> 31);
+    }
+
+    std::uint64_t grid_hash = fnv_offset;
+    std::uint64_t sum = 0;
+    std::uint64_t count = 0;
+    unsigned char last = 0;
+};
+
+// run word_grid once, and read the stats it prints. If seed is set, find one random grid with it.
+// If engine isn't empty, search with it. With hash_grids, instead of the stats, read the grids
+// themselves and fill in only grids and grids_hash
+std::optional<Result> run_word_grid(const Args & args, const std::string & dictionary_filename, int width, int height,
+        const std::optional<int> seed = std::nullopt, const std::string & engine = "", const bool hash_grids = false)
+{
+    std::vector<std::string> arg_strings {args.word_grid_path, "-s", "-d", dictionary_filename};
+    if(!hash_grids)
+        arg_strings.insert(arg_strings.end(), {"-c", "--stats"});
+    if(seed)
+        arg_strings.insert(arg_strings.end(), {"--random", "1", "--seed", std::to_string(*seed)});
+    if(!engine.empty())
+        arg_strings.insert(arg_strings.end(), {"--engine", engine});
+    arg_strings.insert(arg_strings.end(), args.word_grid_args.begin(), args.word_grid_args.end());
+    arg_strings.push_back(std::to_string(width));
+    arg_strings.push_back(std::to_string(height));
+
+    std::vector<char *> exec_args;
+    for(auto & arg: arg_strings)
+        exec_args.push_back(&arg[0]);
+    exec_args.push_back(nullptr);
+
+    int stats_pipe[2];
+    if(pipe(stats_pipe) != 0)
+    {
+        std::cerr<<"Error creating pipe: "<<std::strerror(errno)<<std::endl;
+        return std::nullopt;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    auto pid = fork();
+    if(pid < 0)
+    {
+        std::cerr<<"Error starting "<<args.word_grid_path<<": "<<std::strerror(errno)<<std::endl;
+        close(stats_pipe[0]);
+        close(stats_pipe[1]);
+        return std::nullopt;
+    }
+    if(pid == 0)
+    {
+        // the counts go to stdout, which we don't need. With hash_grids, the grids go there,
+        // and errors go straight to our stderr
+        if(hash_grids)
+            dup2(stats_pipe[1], STDOUT_FILENO);
+        else
+        {
+            auto null_fd = open("/dev/null", O_WRONLY);
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(stats_pipe[1], STDERR_FILENO);
+            close(null_fd);
+        }
+        close(stats_pipe[0]);
+        close(stats_pipe[1]);
+
+        execv(exec_args[0], exec_args.data());
+        std::fprintf(stderr, "Error running %s: %s\n", exec_args[0], std::strerror(errno));
+        _exit(127);
+    }
+
+    close(stats_pipe[1]);
+
+    std::string stats_text;
+    Grid_set_hash grids_hash;
+    std::array<char, 1 << 16> buffer;
+    ssize_t size = 0;
+    while((size = read(stats_pipe[0], buffer.data(), buffer.size())) > 0 || (size < 0 && errno == EINTR))
+    {
+        if(size > 0 && hash_grids)
+            grids_hash.add(buffer.data(), size);
+        else if(size > 0)
+            stats_text.append(buffer.data(), size);
+    }
+    close(stats_pipe[0]);
+
+    int status = 0;
+    rusage usage{};
+    while(wait4(pid, &status, 0, &usage) < 0)
+    {
+        if(errno != EINTR)
+        {
+            std::cerr<<"Error waiting for "<<args.word_grid_path<<": "<<std::strerror(errno)<<std::endl;
+            return std::nullopt;
+        }
+    }
+
+    auto end = std::chrono::steady_clock::now();
+
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+    {
+        std::cerr<<args.word_grid_path<<" failed on "<<width<<"x"<<height<<":\n"<<stats_text;
+        return std::nullopt;
+    }
+
+    Result result;
+    result.width = width;
+    result.height = height;
+    result.engine = engine;
+    result.seconds = std::chrono::duration<double>(end - start).count();
+    result.peak_rss_kib = usage.ru_maxrss;
+
+    if(hash_grids)
+    {
+        result.grids = grids_hash.grids();
+        result.grids_hash = grids_hash.get();
+        return std::make_optional(result);
+    }
+
+    std::istringstream stats(stats_text);
+    std::string line;
+    while(std::getline(stats, line))
+    {
+        auto sep = line.find(": ");
+        if(sep == std::string::npos)
+            continue;
+
+        auto name = line.substr(0, sep);
+        auto value = line.substr(sep + 2);
+        if(name == "nodes")
+            result.nodes = std::stoull(value);
+        else if(name == "grids")
+            result.grids = std::stoull(value);
+        else if(name == "prefix lookups")
+            result.prefix_lookups = std::stoull(value);
+        else if(name.size() > 11 && name.compare(name.size() - 11, 11, " first grid") == 0 && value != "none")
+            result.first_grid_seconds = std::stod(value);
+    }
+
+    return std::make_optional(result);
+}
+
+void write_json(std::ostream & out, const Args & args, const std::string & dictionary_filename, const std::vector<Result> & results)
+{
+    // none of the strings we write need more escaping than this
+    auto quote = [](const std::string & str)
+    {
+        std::string quoted = "\"";
+        for(auto c: str)
+        {
+            if(c == '"' || c == '\\')
+                quoted += '\\';
+            quoted += c;
+        }
+        return quoted + "\"";
+    };
+
+    out<<"{\n"
+       <<"  \"word_grid\": "<<quote(args.word_grid_path)<<",\n"
+       <<"  \"dictionary\": "<<(args.dictionary_filename.empty() ? std::string{"null"} : quote(dictionary_filename))<<",\n"
+       <<"  \"args\": [";
+    for(std::size_t i = 0; i < args.word_grid_args.size(); ++i)
+        out<<(i ? ", " : "")<<quote(args.word_grid_args[i]);
+    out<<"],\n"
+       <<"  \"repeat\": "<<args.repeat<<",\n"
+       <<"  \"results\": [\n";
+
+    for(std::size_t i = 0; i < results.size(); ++i)
+    {
+        const auto & result = results[i];
+        out<<"    {\"width\": "<<result.width
+           <<", \"height\": "<<result.height;
+        if(!result.engine.empty())
+            out<<", \"engine\": "<<quote(result.engine);
+        out<<", \"seconds\": "<<result.seconds
+           <<", \"nodes\": "<<result.nodes
+           <<", \"nodes_per_second\": "<<(result.seconds > 0.0 ? result.nodes / result.seconds : 0.0)
+           <<", \"prefix_lookups\": "<<result.prefix_lookups
+           <<", \"grids\": "<<result.grids
+           <<", \"peak_rss_kib\": "<<result.peak_rss_kib
+           <<"}"<<(i + 1 < results.size() ? "," : "")<<"\n";
+    }
+
+    out<<"  ]\n"
+       <<"}\n";
+}
+
+// value below which fraction of the sorted values fall, picking the nearest one
+double percentile(const std::vector<double> & sorted, const double fraction)
+{
+    if(sorted.empty())
+        return 0.0;
+    auto rank = static_cast<std::size_t>(fraction * sorted.size() + 0.5);
+    return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+void write_random_json(std::ostream & out, const Args & args, const std::vector<Random_result> & results)
+{
+    out<<"{\n"
+       <<"  \"random_runs\": "<<args.random_runs<<",\n"
+       <<"  \"results\": [\n";
+
+    for(std::size_t i = 0; i < results.size(); ++i)
+    {
+        const auto & result = results[i];
+        out<<"    {\"width\": "<<result.width
+           <<", \"height\": "<<result.height
+           <<", \"runs\": "<<result.runs
+           <<", \"found\": "<<result.found
+           <<", \"first_grid_p50\": "<<result.first_grid_p50
+           <<", \"first_grid_p99\": "<<result.first_grid_p99
+           <<", \"seconds_p50\": "<<result.seconds_p50
+           <<", \"seconds_p99\": "<<result.seconds_p99
+           <<"}"<<(i + 1 < results.size() ? "," : "")<<"\n";
+    }
+
+    out<<"  ]\n"
+       <<"}\n";
+}
+
+// time word_grid --random 1 with seeds 1 to args.random_runs on each size
+bool run_random(const Args & args, const std::string & dictionary_filename, std::vector<Random_result> & results)
+{
+    std::printf("%-6s %6s %6s %16s %16s %12s %12s\n", "size", "runs", "found", "first grid p50", "first grid p99", "wall p50", "wall p99");
+    for(auto & size: args.sizes)
+    {
+        Random_result result;
+        result.width = size.first;
+        result.height = size.second;
+        result.runs = args.random_runs;
+
+        std::vector<double> first_grid, wall;
+        for(int seed = 1; seed <= args.random_runs; ++seed)
+        {
+            auto run = run_word_grid(args, dictionary_filename, size.first, size.second, seed);
+            if(!run)
+                return false;
+
+            wall.push_back(run->seconds);
+            if(run->first_grid_seconds >= 0.0)
+                first_grid.push_back(run->first_grid_seconds);
+        }
+        std::sort(first_grid.begin(), first_grid.end());
+        std::sort(wall.begin(), wall.end());
+
+        result.found = first_grid.size();
+        result.first_grid_p50 = percentile(first_grid, 0.5);
+        result.first_grid_p99 = percentile(first_grid, 0.99);
+        result.seconds_p50 = percentile(wall, 0.5);
+        result.seconds_p99 = percentile(wall, 0.99);
+
+        auto size_name = std::to_string(result.width) + "x" + std::to_string(result.height);
+        std::printf("%-6s %6d %6d %16.6f %16.6f %12.4f %12.4f\n", size_name.c_str(), result.runs, result.found,
+                result.first_grid_p50, result.first_grid_p99, result.seconds_p50, result.seconds_p99);
+        std::fflush(stdout);
+
+        results.push_back(result);
+    }
+    return true;
+}
+
+int main(int argc, char ** argv)
+{
+    auto args = parse_arguments(argc, argv);
+    if(!args)
+        return EXIT_FAILURE;
+
+    // generated dictionaries go in a temp file, which is removed when we're done
+    auto dictionary_filename = args->dictionary_filename;
+    if(dictionary_filename.empty())
+    {
+        const char * tmp_dir = std::getenv("TMPDIR");
+        std::string name_template = std::string{tmp_dir ? tmp_dir : "/tmp"} + "/word_grid_bench.XXXXXX";
+        auto fd = mkstemp(&name_template[0]);
+        if(fd < 0)
+        {
+            std::cerr<<"Error creating temporary dictionary: "<<std::strerror(errno)<<std::endl;
+            return EXIT_FAILURE;
+        }
+        close(fd);
+        dictionary_filename = name_template;
+
+        if(!generate_dictionary(dictionary_filename))
+        {
+            std::remove(dictionary_filename.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+
+    if(args->random_runs != 0)
+    {
+        std::vector<Random_result> results;
+        auto success = run_random(*args, dictionary_filename, results);
+
+        if(args->dictionary_filename.empty())
+            std::remove(dictionary_filename.c_str());
+
+        if(!success)
+            return EXIT_FAILURE;
+
+        if(args->json_filename == "-")
+            write_random_json(std::cout, *args, results);
+        else if(!args->json_filename.empty())
+        {
+            std::ofstream json(args->json_filename);
+            write_random_json(json, *args, results);
+            if(!json)
+            {
+                std::cerr<<"Error writing "<<args->json_filename<<": "<<std::strerror(errno)<<std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+
+        return EXIT_SUCCESS;
+    }
+
+    std::vector<Result> results;
+    auto success = true;
+
+    // the engine column is only shown when comparing them
+    const auto engines = args->engines.empty() ? std::vector<std::string>{""} : args->engines;
+    const auto engine_width = args->engines.empty() ? 0 : 9;
+
+    std::printf("%-6s %-*s%10s %14s %14s %16s %12s %12s\n", "size", engine_width, engine_width ? "engine" : "",
+            "seconds", "nodes", "nodes/s", "prefix lookups", "grids", "peak RSS KiB");
+    for(auto & size: args->sizes)
+    {
+        for(auto & engine: engines)
+        {
+            std::optional<Result> best;
+            for(int i = 0; i < args->repeat; ++i)
+            {
+                auto result = run_word_grid(*args, dictionary_filename, size.first, size.second, std::nullopt, engine);
+                if(!result)
+                {
+                    success = false;
+                    break;
+                }
+
+                if(!best || result->seconds < best->seconds)
+                {
+                    auto peak_rss_kib = best ? std::max(best->peak_rss_kib, result->peak_rss_kib) : result->peak_rss_kib;
+                    best = result;
+                    best->peak_rss_kib = peak_rss_kib;
+                }
+                else
+                    best->peak_rss_kib = std::max(best->peak_rss_kib, result->peak_rss_kib);
+            }
+            if(!success)
+                break;
+
+            auto size_name = std::to_string(best->width) + "x" + std::to_string(best->height);
+            std::printf("%-6s %-*s%10.3f %14llu %14.0f %16llu %12llu %12ld\n", size_name.c_str(), engine_width, engine.c_str(), best->seconds,
+                    static_cast<unsigned long long>(best->nodes),
+                    best->seconds > 0.0 ? best->nodes / best->seconds : 0.0,
+                    static_cast<unsigned long long>(best->prefix_lookups),
+                    static_cast<unsigned long long>(best->grids),
+                    best->peak_rss_kib);
+            std::fflush(stdout);
+
+            // every engine has to find the same grids, which an untimed run that outputs them checks
+            if(!args->engines.empty())
+            {
+                auto grids = run_word_grid(*args, dictionary_filename, size.first, size.second, std::nullopt, engine, true);
+                if(!grids)
+                {
+                    success = false;
+                    break;
+                }
+                if(grids->grids != best->grids)
+                {
+                    std::cerr<<"--engine "<<engine<<" output "<<grids->grids<<" grids for "<<size_name<<", but counted "
+                        <<best->grids<<"\n";
+                    success = false;
+                }
+                best->grids_hash = grids->grids_hash;
+            }
+            if(!results.empty() && results.back().width == best->width && results.back().height == best->height
+                    && (results.back().grids != best->grids || results.back().grids_hash != best->grids_hash))
+            {
+                std::cerr<<"--engine "<<engine<<" found "<<best->grids<<" grids for "<<size_name<<", but --engine "
+                    <<results.back().engine<<" found "<<results.back().grids
+                    <<(results.back().grids == best->grids ? ", and they aren't the same ones" : "")<<"\n";
+                success = false;
+            }
+
+            results.push_back(*best);
+        }
+        if(!success)
+            break;
+    }
+
+    if(args->dictionary_filename.empty())
+        std::remove(dictionary_filename.c_str());
+
+    if(!success)
+        return EXIT_FAILURE;
+
+    if(args->json_filename == "-")
+        write_json(std::cout, *args, dictionary_filename, results);
+    else if(!args->json_filename.empty())
+    {
+        std::ofstream json(args->json_filename);
+        write_json(json, *args, dictionary_filename, results);
+        if(!json)
+        {
+            std::cerr<<"Error writing "<<args->json_filename<<": "<<std::strerror(errno)<<std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,247 @@
+// Copyright 2017 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// word_grid --offload cuda: solves batches of grids' last two rows on a CUDA
+// device. The row words and the column trie are copied over once per job.
+// Each thread takes one candidate for the next to last row of one subproblem,
+// follows the column trie through it, then tries every other candidate of the
+// subproblem below it. That's the same work Cpu_bottom_rows does in
+// word_grid.cpp, which the results have to match
+
+#include "word_grid_offload.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+
+#include <cuda_runtime.h>
+
+namespace offload
+{
+namespace
+{
+    constexpr int block_size = 256;
+
+    // print err if it's an error, and return whether it isn't
+    bool check(const cudaError_t err, const char * what)
+    {
+        if(err == cudaSuccess)
+            return true;
+        std::cerr<<"CUDA error "<<what<<": "<<cudaGetErrorString(err)<<"\n";
+        return false;
+    }
+
+    // device memory, freed when done with
+    template <typename T>
+    class Device_buffer
+    {
+    public:
+        Device_buffer() = default;
+        Device_buffer(const Device_buffer &) = delete;
+        Device_buffer & operator=(const Device_buffer &) = delete;
+        ~Device_buffer() { cudaFree(data); }
+
+        // make room for at least size Ts. What was there is lost when it has to grow
+        bool reserve(const std::size_t size)
+        {
+            if(size <= capacity)
+                return true;
+            cudaFree(data);
+            data = nullptr;
+            capacity = 0;
+            if(!check(cudaMalloc(&data, size * sizeof(T)), "allocating device memory"))
+                return false;
+            capacity = size;
+            return true;
+        }
+
+        // an empty copy still allocates, so data is never null
+        bool copy_from(const T * host, const std::size_t size, cudaStream_t stream)
+        {
+            return reserve(std::max<std::size_t>(size, 1))
+                && (size == 0 || check(cudaMemcpyAsync(data, host, size * sizeof(T), cudaMemcpyHostToDevice, stream), "copying to the device"));
+        }
+
+        T * data = nullptr;
+        std::size_t capacity = 0;
+    };
+
+    __global__ void solve_kernel(const Trie_node * nodes, const char * letters, const Letter_mask * masks, const int width,
+            const Subproblem * subproblems, const std::uint32_t num_subproblems,
+            const std::uint32_t * candidates, const std::uint32_t num_candidates,
+            Solution * solutions, const std::uint32_t capacity, unsigned int * num_solutions)
+    {
+        const std::uint32_t i = blockIdx.x * blockDim.x + threadIdx.x;
+        if(i >= num_candidates)
+            return;
+
+        // find which subproblem candidate i is in. Their candidates are in order
+        std::uint32_t low = 0, high = num_subproblems;
+        while(high - low > 1)
+        {
+            const auto mid = low + (high - low) / 2;
+            if(subproblems[mid].first_candidate <= i)
+                low = mid;
+            else
+                high = mid;
+        }
+        const auto & subproblem = subproblems[low];
+
+        // put the candidate in the next to last row, if every column can continue with its letter
+        const auto upper = candidates[i];
+        const char * upper_letters = letters + static_cast<std::size_t>(upper) * width;
+        std::uint32_t below[alphabet_len];
+        for(int c = 0; c < width; ++c)
+        {
+            below[c] = nodes[subproblem.cols[c]].next[upper_letters[c] - 'A'];
+            if(below[c] == 0)
+                return;
+        }
+
+        // and every candidate that shares no letter with it, and finishes every column, in the last row
+        const auto upper_mask = masks[upper];
+        const auto end = subproblem.first_candidate + subproblem.num_candidates;
+        for(auto j = subproblem.first_candidate; j < end; ++j)
+        {
+            const auto lower = candidates[j];
+            if(masks[lower] & upper_mask)
+                continue;
+
+            const char * lower_letters = letters + static_cast<std::size_t>(lower) * width;
+            bool fits = true;
+            for(int c = 0; c < width && fits; ++c)
+                fits = nodes[below[c]].next[lower_letters[c] - 'A'] != 0;
+            if(!fits)
+                continue;
+
+            const auto index = atomicAdd(num_solutions, 1u);
+            if(index < capacity)
+            {
+                solutions[index].subproblem = low;
+                solutions[index].rows[0] = upper;
+                solutions[index].rows[1] = lower;
+            }
+        }
+    }
+}
+
+struct Cuda_device::Impl
+{
+    std::mutex mutex; // one batch at a time
+
+    cudaStream_t stream = nullptr;
+    int width = 0;
+
+    Device_buffer<Trie_node> nodes;
+    Device_buffer<char> letters;
+    Device_buffer<Letter_mask> masks;
+    Device_buffer<Subproblem> subproblems;
+    Device_buffer<std::uint32_t> candidates;
+    Device_buffer<Solution> solutions;
+    Device_buffer<unsigned int> num_solutions;
+
+    std::vector<Solution> host_solutions;
+
+    ~Impl()
+    {
+        if(stream)
+            cudaStreamDestroy(stream);
+    }
+};
+
+Cuda_device::Cuda_device(std::unique_ptr<Impl> impl): impl{std::move(impl)} {}
+Cuda_device::~Cuda_device() = default;
+
+std::unique_ptr<Cuda_device> Cuda_device::create(const Trie_node * nodes, const std::size_t num_nodes,
+        const char * letters, const Letter_mask * masks, const std::size_t num_words, const int width)
+{
+    int num_devices = 0;
+    if(!check(cudaGetDeviceCount(&num_devices), "finding devices"))
+        return nullptr;
+    if(num_devices == 0)
+    {
+        std::cerr<<"No CUDA devices found\n";
+        return nullptr;
+    }
+
+    auto impl = std::make_unique<Impl>();
+    impl->width = width;
+    if(!check(cudaStreamCreate(&impl->stream), "creating a stream")
+            || !impl->nodes.copy_from(nodes, num_nodes, impl->stream)
+            || !impl->letters.copy_from(letters, num_words * width, impl->stream)
+            || !impl->masks.copy_from(masks, num_words, impl->stream)
+            || !impl->num_solutions.reserve(1)
+            || !check(cudaStreamSynchronize(impl->stream), "copying the dictionary"))
+        return nullptr;
+
+    return std::unique_ptr<Cuda_device>{new Cuda_device{std::move(impl)}};
+}
+
+bool Cuda_device::solve(const std::vector<Subproblem> & subproblems, const std::vector<std::uint32_t> & candidates,
+        std::vector<Solution> & solutions)
+{
+    if(subproblems.empty() || candidates.empty())
+        return true;
+
+    std::lock_guard lock{impl->mutex};
+    auto & device = *impl;
+
+    if(!device.subproblems.copy_from(subproblems.data(), subproblems.size(), device.stream)
+            || !device.candidates.copy_from(candidates.data(), candidates.size(), device.stream))
+        return false;
+
+    // room for as many solutions as candidates to start with. If there are more, make room and run it again
+    auto capacity = std::max(device.solutions.capacity, candidates.size());
+    unsigned int num_solutions = 0;
+    while(true)
+    {
+        if(!device.solutions.reserve(capacity)
+                || !check(cudaMemsetAsync(device.num_solutions.data, 0, sizeof(unsigned int), device.stream), "clearing the solution count"))
+            return false;
+
+        const auto num_blocks = static_cast<unsigned int>((candidates.size() + block_size - 1) / block_size);
+        solve_kernel<<<num_blocks, block_size, 0, device.stream>>>(device.nodes.data, device.letters.data, device.masks.data, device.width,
+                device.subproblems.data, subproblems.size(), device.candidates.data, candidates.size(),
+                device.solutions.data, device.solutions.capacity, device.num_solutions.data);
+        if(!check(cudaGetLastError(), "starting the search")
+                || !check(cudaMemcpyAsync(&num_solutions, device.num_solutions.data, sizeof(unsigned int), cudaMemcpyDeviceToHost, device.stream), "reading the solution count")
+                || !check(cudaStreamSynchronize(device.stream), "searching"))
+            return false;
+
+        if(num_solutions <= device.solutions.capacity)
+            break;
+        capacity = num_solutions;
+    }
+
+    device.host_solutions.resize(num_solutions);
+    if(num_solutions > 0
+            && (!check(cudaMemcpyAsync(device.host_solutions.data(), device.solutions.data, num_solutions * sizeof(Solution), cudaMemcpyDeviceToHost, device.stream), "reading solutions")
+                || !check(cudaStreamSynchronize(device.stream), "reading solutions")))
+        return false;
+
+    // threads finish in any order, so sort them to give the same output every time
+    std::sort(device.host_solutions.begin(), device.host_solutions.end(), [](const Solution & a, const Solution & b)
+    {
+        return a.subproblem != b.subproblem ? a.subproblem < b.subproblem : a.rows < b.rows;
+    });
+    solutions.insert(solutions.end(), device.host_solutions.begin(), device.host_solutions.end());
+    return true;
+}
+}
@@ -0,0 +1,96 @@
+// Copyright 2017 Matthew Chandler
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// what word_grid --offload hands to a device: batches of grids with all but
+// their last two rows filled, to find every pair of words that finishes each.
+// Only plain data crosses here, so word_grid.cpp never needs a device compiler
+
+#ifndef WORD_GRID_OFFLOAD_HPP
+#define WORD_GRID_OFFLOAD_HPP
+
+#include <array>
+#include <memory>
+#include <vector>
+
+#include <type_traits>
+
+#include <cstddef>
+#include <cstdint>
+
+// the most letters an alphabet can have, which both sides have to agree on
+#ifndef WORD_GRID_MAX_LETTERS
+#define WORD_GRID_MAX_LETTERS 26
+#endif
+
+namespace offload
+{
+    constexpr int alphabet_len = WORD_GRID_MAX_LETTERS;
+
+    // same as word_grid.cpp's Letter_mask
+    using Letter_mask = std::conditional_t<alphabet_len <= 32, std::uint32_t, std::uint64_t>;
+
+    // same layout as Prefix_trie::Node
+    struct Trie_node
+    {
+        std::array<std::uint32_t, alphabet_len> next;
+        Letter_mask letters;
+    };
+
+    // a grid with all but its last two rows placed. Its candidates are the words that can go in either
+    // of those rows, as they share no letter with the rows above, and are in sorted order
+    struct Subproblem
+    {
+        std::array<std::uint32_t, alphabet_len> cols; // each column's trie node below the placed rows
+        std::uint32_t first_candidate = 0;            // where its candidates start in the batch's list
+        std::uint32_t num_candidates = 0;
+    };
+
+    // words that finish a subproblem, as indexes into the row word list
+    struct Solution
+    {
+        std::uint32_t subproblem = 0;
+        std::array<std::uint32_t, 2> rows{};
+    };
+
+#ifdef WORD_GRID_CUDA
+    // a CUDA device with one job's row words and column trie copied to it. Defined in word_grid_cuda.cu
+    class Cuda_device
+    {
+    public:
+        // nullptr, after printing why, if there's no device to use
+        static std::unique_ptr<Cuda_device> create(const Trie_node * nodes, std::size_t num_nodes,
+                const char * letters, const Letter_mask * masks, std::size_t num_words, int width);
+        ~Cuda_device();
+
+        // append every pair of candidates that finishes each subproblem to solutions, ordered by subproblem,
+        // then by the rows' word indexes. Can be called from several threads, which take turns.
+        // Returns false, after printing why, on a device error
+        bool solve(const std::vector<Subproblem> & subproblems, const std::vector<std::uint32_t> & candidates,
+                std::vector<Solution> & solutions);
+
+    private:
+        struct Impl;
+        explicit Cuda_device(std::unique_ptr<Impl> impl);
+        std::unique_ptr<Impl> impl;
+    };
+#endif
+}
+
+#endif // WORD_GRID_OFFLOAD_HPP